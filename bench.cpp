@@ -0,0 +1,305 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "Creature.h"
+#include "AxonTypes.h"
+#include "GenomeHash.h"
+#include "KdTree.h"
+#include "Muscle.h"
+#include "SensorAxons.h"
+
+using namespace EVOL_NS;
+
+//times the same population in a normal and a deterministic (fixed point)
+//    world.  Usage: evol_bench [creatures] [ticks] [threads]
+//    or, to check the physics rather than time it: evol_bench check [threads]
+
+class BallEnd : public PositionableObject {
+public:
+    BallEnd(PositTy x, PositTy y) : PositionableObject(x,y) {}
+    virtual PositionableObject::MassTy getMass() {return 1.0_kg;}
+    virtual PositionableObjectPtr clone() {return PositionableObjectPtr(new BallEnd(*this));}
+};
+
+//a ladder of nodes held apart by bones, with muscles along its sides that
+//    flex by how far the ladder has tipped over
+Creature makeLadder(int rungs, double x0)
+{
+    Creature c;
+    auto node = [](int rung, int side) {return "n" + std::to_string(rung) + "_" + std::to_string(side);};
+    for(int r = 0; r < rungs; ++r)
+        for(int side = 0; side < 2; ++side)
+            c.addNode(node(r, side), new BallEnd(units::length::meter_t(x0 + side), units::length::meter_t(1.0 + r)));
+    c.add("tilt", new SensorAxon(c.getNodeNamed(node(0, 0)), c.getNodeNamed(node(rungs - 1, 0))));
+    for(int r = 0; r < rungs; ++r)
+    {
+        std::string rung = "r" + std::to_string(r);
+        c.add(rung, new Bone());
+        c.connectBone(rung, node(r, 0), node(r, 1));
+        if( r + 1 == rungs ) continue;
+        for(int side = 0; side < 2; ++side)
+        {
+            std::string musc = "m" + std::to_string(r) + "_" + std::to_string(side);
+            c.add(musc, new Muscle(Muscle::RigidityTy(50.0), 1.0_m, MuscleActivation(MuscleActivation::SIGMOID, 0.7, 1.3, side ? 2.0 : -2.0)));
+            c.connectMuscle(musc, node(r, side), node(r + 1, side));
+            c.addAxonAsInputTo("tilt", musc);
+        }
+    }
+    return c;
+}
+
+//gravity and a hilly terrain
+void setUpWorld(PhysicsWorld& world)
+{
+    world.getForceFields().setGravity(Acceleration(units::acceleration::meters_per_second_squared_t(0.0),
+                                                   units::acceleration::meters_per_second_squared_t(-9.8)));
+    std::mt19937 rng(1);
+    world.setTerrain(Terrain::generate(rng, 8, -10.0_m, 0.5_m, 2.0_m, 0.5));
+}
+
+//ticks of the whole population per second
+double run(std::vector<Creature> population, int ticks, ThreadPool* pool, bool deterministic)
+{
+    SimulationContext ctx;
+    PhysicsWorld& world = ctx.getWorld();
+    world.setThreadPool(pool);
+    setUpWorld(world);
+    for(auto& c : population)
+        c.addToWorld(world);
+    world.setDeterministic(deterministic);
+    auto start = std::chrono::steady_clock::now();
+    for(; ctx.getTicks() < ticks; ctx.advanceTick())
+    {
+        for(auto& c : population)
+            c.update(ctx);
+        world.update();
+    }
+    std::chrono::duration<double> taken = std::chrono::steady_clock::now() - start;
+    return ticks / taken.count();
+}
+
+//a hash of the fixed point state of population after ticks deterministic
+//    ticks, with the springs applied by pass
+uint64_t fixedStateHash(std::vector<Creature> population, int ticks, ThreadPool* pool, PhysicsWorld::SpringPassTy pass)
+{
+    SimulationContext ctx;
+    PhysicsWorld& world = ctx.getWorld();
+    world.setThreadPool(pool);
+    world.setSpringPass(pass);
+    world.setParallelThreshold(0);
+    setUpWorld(world);
+    for(auto& c : population)
+        c.addToWorld(world);
+    world.setDeterministic(true);
+    for(; ctx.getTicks() < ticks; ctx.advanceTick())
+    {
+        for(auto& c : population)
+            c.update(ctx);
+        world.update();
+    }
+    Hasher hash;
+    for(int64_t raw : world.getFixedState())
+        hash.add(uint64_t(raw));
+    return hash.get();
+}
+
+//a deterministic world must end up with the same bits whichever way the
+//    springs are applied and on however many threads.  The hash is printed
+//    so that it can be compared between machines as well
+bool checkDeterminism(unsigned threads)
+{
+    std::vector<Creature> population;
+    for(int i = 0; i < 20; ++i)
+        population.push_back(makeLadder(8, i * 0.7));
+    ThreadPool one(1), many(threads);
+    const char* names[] = {"serial", "colored", "buffered", "automatic"};
+    uint64_t serial = fixedStateHash(population, 300, nullptr, PhysicsWorld::SERIAL);
+    std::cout << "fixed state hash: " << std::hex << serial << std::dec << std::endl;
+    bool same = true;
+    for(ThreadPool* pool : {&one, &many})
+        for(auto pass : {PhysicsWorld::SERIAL, PhysicsWorld::COLORED, PhysicsWorld::BUFFERED, PhysicsWorld::AUTOMATIC})
+            if( fixedStateHash(population, 300, pool, pass) != serial )
+            {
+                std::cout << "  differs: " << names[pass] << " on " << pool->getThreadCount() << " thread(s)" << std::endl;
+                same = false;
+            }
+    return same;
+}
+
+//the largest change in total energy, as a fraction of the first tick's,
+//    over ticks ticks of a spring between two nodes pulled apart, with a
+//    third node held to one end by a bone if withBone.  Stops early if the
+//    world diverges under limit (0 for never on energy), with ran saying
+//    how many ticks it got through
+double energyDrift(double rigidity, bool withBone, bool deterministic, int ticks,
+                   double limit = 0.0, int* ran = nullptr)
+{
+    PhysicsWorld world;
+    PositionableObjectPtr a(new BallEnd(0.0_m, 0.0_m)), b(new BallEnd(3.0_m, 1.0_m)), c(new BallEnd(3.0_m, 3.0_m));
+    MusclePtr spring(new Muscle(Muscle::RigidityTy(rigidity), 2.0_m));
+    BonePtr bone(new Bone());
+    spring->connectEnds(a, b);
+    bone->connectEnds(b, c);
+    world.add(a);
+    world.add(b);
+    world.add(spring);
+    if( withBone )
+    {
+        world.add(c);
+        world.add(bone);
+    }
+    world.setDeterministic(deterministic);
+    world.setDivergenceLimit(units::energy::joule_t(limit));
+    double first = 0.0, drift = 0.0;
+    int tick = 0;
+    for(; tick < ticks and !world.hasDiverged(); ++tick)
+    {
+        world.update();
+        double energy = world.getMetrics().getTotalEnergy()();
+        if( tick == 0 ) first = energy;
+        drift = std::max(drift, std::fabs(energy - first) / first);
+    }
+    if( ran ) *ran = tick;
+    return drift;
+}
+
+//a spring must keep its energy, in doubles and in fixed point, and a far
+//    too stiff one must be stopped for diverging within a few ticks.  The
+//    energy swings by a bounded amount each period (symplectic Euler), so
+//    the run is long enough that a steady gain would show.  Bones are
+//    projected rather than solved, which bleeds off a little energy
+bool checkEnergy()
+{
+    bool kept = true;
+    for(bool withBone : {false, true})
+        for(bool deterministic : {false, true})
+        {
+            double drift = energyDrift(10.0, withBone, deterministic, 20000);
+            std::cout << "  energy drift" << (withBone ? ", bone" : "") << (deterministic ? ", fixed point" : "")
+                      << ": " << drift * 100.0 << "%" << std::endl;
+            kept = kept and drift < (withBone ? 0.01 : 0.002);
+        }
+    int ran = 0;
+    energyDrift(5e6, false, false, 2000, 1e9, &ran);
+    std::cout << "  a 5e6 N/m spring diverged after " << ran << " ticks" << std::endl;
+    return kept and ran < 20;
+}
+
+//the k nearest neighbours from a k-d tree must be the ones a brute force
+//    search finds, in the same order, whether the points arrive at random or
+//    sorted along a dimension (which would unbalance a naive tree), and
+//    when a query skips itself
+bool checkNearest(unsigned threads)
+{
+    const unsigned dims = 6, k = 10;
+    const size_t count = 20000, queries = 200;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    std::vector<double> coords(count * dims);
+    for(double& x : coords)
+        x = uniform(rng);
+    ThreadPool pool(threads);
+    bool same = true;
+    for(bool sorted : {false, true})
+    {
+        std::vector<double> points = coords;
+        if( sorted )
+        {
+            std::vector<size_t> order(count);
+            for(size_t i = 0; i < count; ++i)
+                order[i] = i;
+            std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {return coords[a * dims] < coords[b * dims];});
+            for(size_t i = 0; i < count; ++i)
+                std::copy(&coords[order[i] * dims], &coords[order[i] * dims] + dims, &points[i * dims]);
+        }
+        KdTree tree(dims);
+        for(size_t i = 0; i < count; ++i)
+            tree.add(&points[i * dims]);
+        //the queries are points of the tree, skipping themselves
+        std::vector<KdTree::IndexTy> skip(queries);
+        std::vector<double> targets(queries * dims);
+        for(size_t q = 0; q < queries; ++q)
+        {
+            skip[q] = KdTree::IndexTy(q * (count / queries));
+            std::copy(&points[skip[q] * dims], &points[skip[q] * dims] + dims, &targets[q * dims]);
+        }
+        std::vector<KdTree::Neighbour> found(queries * k);
+        tree.nearest(targets.data(), queries, k, found.data(), &pool, skip.data());
+        for(size_t q = 0; q < queries; ++q)
+        {
+            std::vector<KdTree::Neighbour> all;
+            for(size_t i = 0; i < count; ++i)
+            {
+                if( i == skip[q] ) continue;
+                double distance = 0.0;
+                for(unsigned d = 0; d < dims; ++d)
+                    distance += (points[i * dims + d] - targets[q * dims + d]) * (points[i * dims + d] - targets[q * dims + d]);
+                all.push_back(KdTree::Neighbour{distance, KdTree::IndexTy(i)});
+            }
+            std::partial_sort(all.begin(), all.begin() + k, all.end());
+            for(unsigned j = 0; j < k; ++j)
+                same = same and found[q * k + j].index == all[j].index;
+        }
+    }
+    return same;
+}
+
+//a copy of a creature whose muscle is strung between nodes outside it must
+//    leave that muscle unconnected, and still update, sense and trace
+bool checkOutsideMuscleCopy()
+{
+    PositionableObjectPtr a(new BallEnd(0.0_m, 1.0_m)), b(new BallEnd(1.5_m, 1.0_m));
+    MusclePtr musc(new Muscle(Muscle::RigidityTy(10.0)));
+    musc->connectEnds(a, b);
+    Creature c;
+    c.add("m", musc);
+    c.add("length", new SensorAxon(SensorAxon::MUSCLE_LENGTH, musc));
+    c.addAxonAsInputTo("length", "m");
+    SimulationContext ctx;
+    std::stringstream trace;
+    ctx.setTraceSink(TraceSinkPtr(new StreamTraceSink(trace)));
+    c.update(ctx);
+    Creature d(c);
+    MusclePtr copy = std::dynamic_pointer_cast<Muscle>(d.getPartNamed("m"));
+    d.update(ctx);
+    d.trace(ctx);
+    return musc->isConnected() and !copy->isConnected() and
+           copy->getMuscleLength() == copy->getRestLength() and a->getTotalForce().getX()() != 0.0;
+}
+
+//run every check; false if any failed
+bool check(unsigned threads)
+{
+    bool passed = true;
+    auto report = [&](const char* name, bool ok) {
+        std::cout << (ok ? "pass: " : "FAIL: ") << name << std::endl;
+        passed = passed and ok;
+    };
+    report("deterministic stepping", checkDeterminism(threads));
+    report("energy conservation", checkEnergy());
+    report("nearest neighbours", checkNearest(threads));
+    report("copying a muscle with outside ends", checkOutsideMuscleCopy());
+    return passed;
+}
+
+int main(int argc, char** argv)
+{
+    if( argc > 1 and std::string(argv[1]) == "check" )
+        return check(argc > 2 ? std::atoi(argv[2]) : 4) ? 0 : 1;
+    int creatures = argc > 1 ? std::atoi(argv[1]) : 200;
+    int ticks = argc > 2 ? std::atoi(argv[2]) : 500;
+    unsigned threads = argc > 3 ? std::atoi(argv[3]) : 1;
+    ThreadPool pool(threads);
+    std::vector<Creature> population;
+    for(int i = 0; i < creatures; ++i)
+        population.push_back(makeLadder(8, (i % 100) * 0.7));
+    double normal = run(population, ticks, threads > 1 ? &pool : nullptr, false);
+    double fixed = run(population, ticks, threads > 1 ? &pool : nullptr, true);
+    std::cout << creatures << " creatures, " << ticks << " ticks, " << threads << " thread(s)" << std::endl;
+    std::cout << "double:        " << normal << " ticks/s" << std::endl;
+    std::cout << "deterministic: " << fixed << " ticks/s (" << fixed / normal << "x)" << std::endl;
+    return 0;
+}
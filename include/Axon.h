@@ -2,6 +2,7 @@
 #define _AXON_H__
 
 #include "config.h"
+#include <map>
 #include <memory>
 #include <vector>
 #include "BodyPart.h"
@@ -16,27 +17,51 @@ class CanHaveAxonInputs {
     std::vector<AxonPtr> inputAxons;
 public:
     CanHaveAxonInputs() {}
+    virtual ~CanHaveAxonInputs() {}
 //accessors to the input vector
     void addAxonAsInput(AxonPtr in) { inputAxons.push_back(in); }
     decltype(inputAxons)::iterator inputBegin() { return inputAxons.begin(); }
     decltype(inputAxons)::iterator inputEnd() { return inputAxons.end(); }
+//point our inputs at their copies, after the part we belong to was cloned;
+//    inputs with no entry in the map are left alone
+    void remapInputs(const std::map<Axon*,AxonPtr>& copies)
+    {
+        for(auto& in : inputAxons)
+        {
+            auto result = copies.find(in.get());
+            if( result != copies.end() )
+                in = result->second;
+        }
+    }
 };
 
 typedef std::shared_ptr<CanHaveAxonInputs> CanHaveAxonInputsPtr;
 
+class PartBatches;
+
 class Axon : public BodyPart, public CanHaveAxonInputs {
+//the batches update and commit axons of a known kind directly
+    friend class PartBatches;
 public:
     typedef float OutputTy;
 private:
 //the old and new values are cached to allow ordering-independent updating
     OutputTy oldValue, newValue;
-    virtual float calculateNewOutput()=0;
+//while a creature is finalized, the committed value lives in its flat value
+//    array instead of oldValue, and this points at our entry there
+    const OutputTy* boundValue;
+    virtual float calculateNewOutput(SimulationContext& ctx)=0;
 public:
-    Axon() : oldValue(0.0), newValue(0.0) {}
+    Axon() : oldValue(0.0), newValue(0.0), boundValue(nullptr) {}
+//copies take the current value, but are never bound
+    Axon(const Axon& other) : BodyPart(other), CanHaveAxonInputs(other),
+        oldValue(other.getOutputValue()), newValue(other.boundValue ? oldValue : other.newValue), boundValue(nullptr) {}
 //an output value
-    OutputTy getOutputValue() { return oldValue; }
+    OutputTy getOutputValue() const { return boundValue ? *boundValue : oldValue; }
+//whether we belong to a finalized creature, whose batches hold our value
+    bool isBound() const { return boundValue != nullptr; }
 //take the other Axon's output values and use some function to create your output
-    virtual void update() { newValue = calculateNewOutput(); }
+    virtual void update(SimulationContext& ctx) { newValue = calculateNewOutput(ctx); }
 //finally, commit the value we calculated
     virtual void commit() { oldValue = newValue; }
 };
@@ -44,4 +69,3 @@ public:
 }; //namespace EVOL_NS
 
 #endif
-
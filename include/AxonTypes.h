@@ -2,33 +2,47 @@
 #define _AXON_TYPES_H__
 
 #include "config.h"
+#include <cassert>
 #include <string>
 #include "Axon.h"
+#include "SimulationContext.h"
 
 namespace EVOL_NS {
 
+//the axon kinds here are final: PartBatches calls their non-virtual
+//    compute() directly, and new kinds should derive from Axon instead
+
 //------------- Axons that don't use any inputs -------------
 
-class ConstAxon : public Axon {
+class ConstAxon final : public Axon {
     Axon::OutputTy constVal;
-    virtual Axon::OutputTy calculateNewOutput() {return constVal;}
+    virtual Axon::OutputTy calculateNewOutput(SimulationContext& ctx) {return compute(ctx);}
 public:
     ConstAxon(Axon::OutputTy init) : constVal(init) {}
+    Axon::OutputTy compute(SimulationContext&) {return constVal;}
+    Axon::OutputTy getConstValue() const {return constVal;}
+//only for a creature that is not finalized: its batches take a copy of the
+//    value, which this would not change
+    void setConstValue(Axon::OutputTy v) {assert(!isBound()); constVal = v;}
     virtual std::string getTypeAsString() {return "ConstAxon";}
+    virtual BodyPartPtr clone() {return BodyPartPtr(new ConstAxon(*this));}
 };
 
-class TimeAxon : public Axon {
-    int& simulationTicks;
-    virtual Axon::OutputTy calculateNewOutput() { return simulationTicks; }
+//outputs the tick count of whichever simulation it is being updated in
+class TimeAxon final : public Axon {
+    virtual Axon::OutputTy calculateNewOutput(SimulationContext& ctx) {return compute(ctx);}
 public:
-    TimeAxon(int& ticks) : simulationTicks(ticks) {}
+    Axon::OutputTy compute(SimulationContext& ctx) { return ctx.getTicks(); }
     virtual std::string getTypeAsString() {return "TimeAxon";}
+    virtual BodyPartPtr clone() {return BodyPartPtr(new TimeAxon(*this));}
 };
 
 //------------- Axons that implement normal math operations  -------------
 
-class AddAxon : public Axon {
-    virtual Axon::OutputTy calculateNewOutput()
+class AddAxon final : public Axon {
+    virtual Axon::OutputTy calculateNewOutput(SimulationContext& ctx) {return compute(ctx);}
+public:
+    Axon::OutputTy compute(SimulationContext&)
     {
         Axon::OutputTy ret = 0;
         for(auto II = Axon::inputBegin(); II != Axon::inputEnd(); ++II)
@@ -37,12 +51,14 @@ class AddAxon : public Axon {
         }
         return ret;
     }
-public:
     virtual std::string getTypeAsString() {return "AddAxon";}
+    virtual BodyPartPtr clone() {return BodyPartPtr(new AddAxon(*this));}
 };
 
-class SubAxon : public Axon {
-    virtual Axon::OutputTy calculateNewOutput()
+class SubAxon final : public Axon {
+    virtual Axon::OutputTy calculateNewOutput(SimulationContext& ctx) {return compute(ctx);}
+public:
+    Axon::OutputTy compute(SimulationContext&)
     {
         Axon::OutputTy ret = 0;
         for(auto II = Axon::inputBegin(); II != Axon::inputEnd(); ++II)
@@ -55,8 +71,8 @@ class SubAxon : public Axon {
         }
         return ret;
     }
-public:
     virtual std::string getTypeAsString() {return "SubAxon";}
+    virtual BodyPartPtr clone() {return BodyPartPtr(new SubAxon(*this));}
 };
 
 
@@ -2,11 +2,18 @@
 #define _BODY_PART_H__
 
 #include "config.h"
+#include <map>
 #include <string>
 #include <memory>
 
 namespace EVOL_NS {
 
+class SimulationContext;
+class PositionableObject;
+class BodyPart;
+
+typedef std::shared_ptr<BodyPart> BodyPartPtr;
+
 //BodyPart uses two stage updating, so that ordering of inputs
 //  does not matter; first, update() is called on all parts, then
 //  commit() is called; this allows a part to update() internally,
@@ -14,17 +21,23 @@ namespace EVOL_NS {
 //  change once all parts have updated
 class BodyPart {
 public:
-//all calcuations are done in update
-    virtual void update()=0;
+    virtual ~BodyPart() {}
+//all calcuations are done in update; anything outside of the creature
+//    (the clock, the physics world) is reached through the context
+    virtual void update(SimulationContext& ctx)=0;
 //commit takes the changes found in update and locks them in
     virtual void commit()=0;
 //every class has a type, specified as a string
     virtual std::string getTypeAsString()=0;
+//copy this part, including its current state; any links to other parts
+//    still point at the originals until the owner remaps them
+    virtual BodyPartPtr clone()=0;
+//after a copy, point any links to other parts or nodes at their copies;
+//    links with no entry in the maps are left alone
+    virtual void remapLinks(const std::map<BodyPart*,BodyPartPtr>&,
+                            const std::map<PositionableObject*,std::shared_ptr<PositionableObject>>&) {}
 };
 
-typedef std::shared_ptr<BodyPart> BodyPartPtr;
-
 }; //namespace EVOL_NS
 
 #endif
-
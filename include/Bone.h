@@ -0,0 +1,68 @@
+#ifndef _BONE_H__
+#define _BONE_H__
+
+#include "config.h"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "BodyPart.h"
+#include "Force.h"
+
+namespace EVOL_NS {
+
+//the bones in a PhysicsWorld, one array per component, with the ends given
+//    as indices into the world's NodeArrays; lengths are in meters
+struct BoneArrays {
+    std::vector<uint32_t> nodeA, nodeB;
+    std::vector<double> length;
+};
+
+//a rigid link that keeps its two ends a fixed distance apart.  Rather than
+//    pushing with a force (which would need a huge rigidity, and so a tiny
+//    TIME_RATE, to stay near-rigid) the world moves the ends back to the right
+//    distance after each step; a bone only has an effect inside a PhysicsWorld
+class Bone final : public BodyPart {
+public:
+    typedef PositionableObject::PositTy LengthTy;
+private:
+//negative until we know our length
+    LengthTy length;
+//the two ends of the bone
+    PositionableObjectPtr objectA, objectB;
+public:
+//a bone that keeps its ends at whatever distance they are when connected
+    Bone() : length(-1.0) {}
+    Bone(LengthTy len) : length(len) {}
+//connect the ends of the bone; this must happen before we are put in a world
+    void connectEnds(PositionableObjectPtr a, PositionableObjectPtr b)
+    {
+        objectA = a;
+        objectB = b;
+        if( length < 0.0_m ) length = getDistance(objectA, objectB);
+    }
+    PositionableObjectPtr getEndA() { return objectA; }
+    PositionableObjectPtr getEndB() { return objectB; }
+    LengthTy getLength() const { return length; }
+    LengthTy getCurrentLength() { return getDistance(objectA, objectB); }
+//needed for BodyPart; a bone has nothing to work out each tick
+    virtual void update(SimulationContext&) {}
+    virtual void commit() {}
+    virtual std::string getTypeAsString() {return "Bone";}
+    virtual BodyPartPtr clone() {return BodyPartPtr(new Bone(*this));}
+    virtual void remapLinks(const std::map<BodyPart*,BodyPartPtr>&,
+                            const std::map<PositionableObject*,PositionableObjectPtr>& nodes)
+    {
+        auto a = nodes.find(objectA.get());
+        auto b = nodes.find(objectB.get());
+        if( a != nodes.end() ) objectA = a->second;
+        if( b != nodes.end() ) objectB = b->second;
+    }
+};
+
+typedef std::shared_ptr<Bone> BonePtr;
+
+}; //namespace EVOL_NS
+
+#endif
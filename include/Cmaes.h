@@ -0,0 +1,522 @@
+#ifndef _CMAES_H__
+#define _CMAES_H__
+
+#include "config.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+#include "AxonTypes.h"
+#include "Creature.h"
+#include "Evaluation.h"
+#include "Muscle.h"
+#include "SimulationContext.h"
+#include "ThreadPool.h"
+
+namespace EVOL_NS {
+
+//the continuous parameters of a creature's topology, as a vector of reals:
+//    constant axon values, muscle rigidities and rest lengths, and the masses
+//    of nodes whose mass can be changed, in that order (each in name order).
+//    Rigidities, lengths and masses must stay positive, so their logarithms
+//    are what goes in the vector
+class ParameterSpace {
+public:
+    enum KindTy {CONST_VALUE, RIGIDITY, REST_LENGTH, MASS};
+    struct Parameter {
+        KindTy kind;
+        std::string name;
+    };
+//where each parameter is in one particular creature, looked up once so that
+//    many vectors can be put into it quickly
+    struct Binding {
+        std::vector<ConstAxon*> axons;
+        std::vector<Muscle*> muscles;
+        std::vector<PositionableObject*> nodes;
+    };
+private:
+    std::vector<Parameter> parameters;
+    size_t axonCount, muscleCount;
+public:
+    ParameterSpace() : axonCount(0), muscleCount(0) {}
+    static ParameterSpace of(const Creature& creature)
+    {
+        ParameterSpace space;
+        for(auto BI = creature.begin(); BI != creature.end(); ++BI)
+            if( std::dynamic_pointer_cast<ConstAxon>(BI->second) )
+                space.parameters.push_back(Parameter{CONST_VALUE, BI->first});
+        space.axonCount = space.parameters.size();
+        for(auto BI = creature.begin(); BI != creature.end(); ++BI)
+            if( std::dynamic_pointer_cast<Muscle>(BI->second) )
+            {
+                space.parameters.push_back(Parameter{RIGIDITY, BI->first});
+                space.parameters.push_back(Parameter{REST_LENGTH, BI->first});
+            }
+        space.muscleCount = (space.parameters.size() - space.axonCount) / 2;
+        //setting a node's own mass changes nothing, and tells us whether it can be set
+        for(auto NI = creature.nodeBegin(); NI != creature.nodeEnd(); ++NI)
+            if( NI->second->setMass(NI->second->getMass()) )
+                space.parameters.push_back(Parameter{MASS, NI->first});
+        return space;
+    }
+    size_t size() const {return parameters.size();}
+    const Parameter& operator [] (size_t i) const {return parameters[i];}
+//find our parameters in creature, which must have the topology we were made
+//    from; false if it does not
+    bool bind(Creature& creature, Binding& out) const
+    {
+        out = Binding();
+        for(size_t i = 0; i < parameters.size(); ++i)
+        {
+            const Parameter& p = parameters[i];
+            if( p.kind == CONST_VALUE )
+            {
+                ConstAxon* axon = dynamic_cast<ConstAxon*>(creature.getPartNamed(p.name).get());
+                if( !axon ) return false;
+                out.axons.push_back(axon);
+            }
+            else if( p.kind == RIGIDITY )
+            {
+                Muscle* muscle = dynamic_cast<Muscle*>(creature.getPartNamed(p.name).get());
+                if( !muscle ) return false;
+                out.muscles.push_back(muscle);
+            }
+            else if( p.kind == MASS )
+            {
+                PositionableObjectPtr node = creature.getNodeNamed(p.name);
+                if( !node ) return false;
+                out.nodes.push_back(node.get());
+            }
+        }
+        return true;
+    }
+//the vector for a bound creature
+    std::vector<double> read(const Binding& binding) const
+    {
+        std::vector<double> x;
+        for(ConstAxon* axon : binding.axons)
+            x.push_back(axon->getConstValue());
+        for(Muscle* muscle : binding.muscles)
+        {
+            x.push_back(std::log(muscle->getRigidity()()));
+            x.push_back(std::log(muscle->getRestLength()()));
+        }
+        for(PositionableObject* node : binding.nodes)
+            x.push_back(std::log(units::mass::kilogram_t(node->getMass())()));
+        return x;
+    }
+//set a bound creature's parameters from the size() values at x; the creature
+//    must not be in a world or finalized
+    void apply(const Binding& binding, const double* x) const
+    {
+        for(ConstAxon* axon : binding.axons)
+            axon->setConstValue(Axon::OutputTy(*x++));
+        for(Muscle* muscle : binding.muscles)
+        {
+            muscle->setRigidity(Muscle::RigidityTy(std::exp(x[0])));
+            muscle->setRestLength(Muscle::LengthTy(std::exp(x[1])));
+            x += 2;
+        }
+        for(PositionableObject* node : binding.nodes)
+            node->setMass(units::mass::kilogram_t(std::exp(*x++)));
+    }
+    bool apply(const std::vector<double>& x, Creature& creature) const
+    {
+        Binding binding;
+        if( x.size() != size() or !bind(creature, binding) ) return false;
+        apply(binding, x.data());
+        return true;
+    }
+//a sensible size for a first step in each parameter: a factor of e for the
+//    positive ones, and the value itself (but at least 1) for constants
+    std::vector<double> scales(const std::vector<double>& x) const
+    {
+        std::vector<double> s(size(), 1.0);
+        for(size_t i = 0; i < axonCount and i < x.size(); ++i)
+            s[i] = std::max(1.0, std::fabs(x[i]));
+        return s;
+    }
+};
+
+//the covariance matrix adaptation evolution strategy, maximizing: each
+//    generation sample() gives a batch of candidate vectors drawn around the
+//    mean, and update() takes their fitness and moves the mean, step size and
+//    covariance towards what worked.  The full form learns correlations
+//    between parameters but costs O(n^2) per candidate and an O(n^3)
+//    eigendecomposition every so often; the separable form keeps only the
+//    diagonal, costing O(n), and learns faster in it, which suits many
+//    parameters better
+class Cmaes {
+public:
+    enum CovarianceTy {
+        FULL,
+        SEPARABLE,
+        AUTOMATIC //full up to 100 dimensions, separable beyond
+    };
+private:
+    size_t n, lambda, mu;
+    CovarianceTy covariance;
+    std::vector<double> weights;
+    double mueff, cs, ds, cc, c1, cmu, chiN;
+    std::vector<double> mean, ps, pc;
+//the covariance (n*n, or its diagonal when separable), its eigenvectors as
+//    columns and the square roots of its eigenvalues
+    std::vector<double> C, B, D;
+    double sigma;
+    size_t generation, eigenEvery, eigenGeneration;
+//the last batch, as candidates and as steps (candidate - mean) / sigma
+    std::vector<double> candidates, steps;
+    std::vector<double> best;
+    double bestFitness;
+//eigendecomposition of the symmetric n*n matrix a by cyclic Jacobi rotations
+    static void decompose(std::vector<double> a, size_t n, std::vector<double>& vectors, std::vector<double>& values)
+    {
+        vectors.assign(n * n, 0.0);
+        for(size_t i = 0; i < n; ++i)
+            vectors[i * n + i] = 1.0;
+        for(int sweep = 0; sweep < 64; ++sweep)
+        {
+            double off = 0.0, diagonal = 0.0;
+            for(size_t r = 0; r < n; ++r)
+            {
+                diagonal += a[r * n + r] * a[r * n + r];
+                for(size_t c = r + 1; c < n; ++c)
+                    off += a[r * n + c] * a[r * n + c];
+            }
+            if( off <= 1e-30 * diagonal ) break;
+            for(size_t p = 0; p < n; ++p)
+                for(size_t q = p + 1; q < n; ++q)
+                {
+                    double apq = a[p * n + q];
+                    if( apq == 0.0 ) continue;
+                    double theta = (a[q * n + q] - a[p * n + p]) / (2.0 * apq);
+                    double t = (theta >= 0 ? 1.0 : -1.0) / (std::fabs(theta) + std::sqrt(theta * theta + 1.0));
+                    double c = 1.0 / std::sqrt(t * t + 1.0), s = t * c;
+                    for(size_t k = 0; k < n; ++k)
+                    {
+                        double akp = a[k * n + p], akq = a[k * n + q];
+                        a[k * n + p] = c * akp - s * akq;
+                        a[k * n + q] = s * akp + c * akq;
+                    }
+                    for(size_t k = 0; k < n; ++k)
+                    {
+                        double apk = a[p * n + k], aqk = a[q * n + k];
+                        a[p * n + k] = c * apk - s * aqk;
+                        a[q * n + k] = s * apk + c * aqk;
+                    }
+                    for(size_t k = 0; k < n; ++k)
+                    {
+                        double vkp = vectors[k * n + p], vkq = vectors[k * n + q];
+                        vectors[k * n + p] = c * vkp - s * vkq;
+                        vectors[k * n + q] = s * vkp + c * vkq;
+                    }
+                }
+        }
+        values.resize(n);
+        for(size_t i = 0; i < n; ++i)
+            values[i] = a[i * n + i];
+    }
+    void refreshEigen()
+    {
+        if( covariance == SEPARABLE )
+        {
+            for(size_t i = 0; i < n; ++i)
+                D[i] = std::sqrt(std::max(C[i], 1e-300));
+            return;
+        }
+        std::vector<double> values;
+        decompose(C, n, B, values);
+        for(size_t i = 0; i < n; ++i)
+            D[i] = std::sqrt(std::max(values[i], 1e-300));
+        eigenGeneration = generation;
+    }
+public:
+//start around mean with step size sigma, each parameter's step further
+//    scaled by scales if given; lambda 0 takes the usual 4 + 3 ln n
+    Cmaes(const std::vector<double>& start, double stepSize, CovarianceTy cov = AUTOMATIC, size_t populationSize = 0,
+          const std::vector<double>& scales = std::vector<double>()) :
+        n(std::max<size_t>(1, start.size())), covariance(cov), mean(start), sigma(stepSize),
+        generation(0), eigenGeneration(0), bestFitness(-std::numeric_limits<double>::infinity())
+    {
+        mean.resize(n, 0.0);
+        if( covariance == AUTOMATIC ) covariance = n <= 100 ? FULL : SEPARABLE;
+        lambda = populationSize >= 2 ? populationSize : 4 + size_t(3.0 * std::log(double(n)));
+        mu = lambda / 2;
+        for(size_t i = 0; i < mu; ++i)
+            weights.push_back(std::log(mu + 0.5) - std::log(i + 1.0));
+        double sum = std::accumulate(weights.begin(), weights.end(), 0.0), squares = 0.0;
+        for(double& w : weights)
+        {
+            w /= sum;
+            squares += w * w;
+        }
+        mueff = 1.0 / squares;
+        double dims = double(n);
+        cs = (mueff + 2.0) / (dims + mueff + 5.0);
+        ds = 1.0 + 2.0 * std::max(0.0, std::sqrt((mueff - 1.0) / (dims + 1.0)) - 1.0) + cs;
+        cc = (4.0 + mueff / dims) / (dims + 4.0 + 2.0 * mueff / dims);
+        c1 = 2.0 / ((dims + 1.3) * (dims + 1.3) + mueff);
+        cmu = std::min(1.0 - c1, 2.0 * (mueff - 2.0 + 1.0 / mueff) / ((dims + 2.0) * (dims + 2.0) + mueff));
+        if( covariance == SEPARABLE )
+        {
+            //with only the diagonal to learn it can be learnt (n+2)/3 times as fast
+            c1 *= (dims + 2.0) / 3.0;
+            cmu = std::min(1.0 - c1, cmu * (dims + 2.0) / 3.0);
+        }
+        chiN = std::sqrt(dims) * (1.0 - 1.0 / (4.0 * dims) + 1.0 / (21.0 * dims * dims));
+        eigenEvery = std::max<size_t>(1, size_t(1.0 / ((c1 + cmu) * dims * 10.0)));
+        ps.assign(n, 0.0);
+        pc.assign(n, 0.0);
+        D.assign(n, 1.0);
+        for(size_t i = 0; i < n and i < scales.size(); ++i)
+            D[i] = scales[i];
+        if( covariance == SEPARABLE )
+        {
+            C.resize(n);
+            for(size_t i = 0; i < n; ++i)
+                C[i] = D[i] * D[i];
+        }
+        else
+        {
+            C.assign(n * n, 0.0);
+            B.assign(n * n, 0.0);
+            for(size_t i = 0; i < n; ++i)
+            {
+                C[i * n + i] = D[i] * D[i];
+                B[i * n + i] = 1.0;
+            }
+        }
+        best = mean;
+    }
+    size_t getDimensions() const {return n;}
+    size_t getPopulationSize() const {return lambda;}
+    CovarianceTy getCovariance() const {return covariance;}
+    size_t getGeneration() const {return generation;}
+    const std::vector<double>& getMean() const {return mean;}
+    double getSigma() const {return sigma;}
+//the best candidate update() has been told of, and its fitness
+    const std::vector<double>& getBest() const {return best;}
+    double getBestFitness() const {return bestFitness;}
+//the largest standard deviation of the search in any one parameter
+    double getSpread() const
+    {
+        double largest = 0.0;
+        for(size_t i = 0; i < n; ++i)
+            largest = std::max(largest, covariance == SEPARABLE ? C[i] : C[i * n + i]);
+        return sigma * std::sqrt(largest);
+    }
+//draw the next batch: getPopulationSize() candidates of getDimensions()
+//    values each, packed one after another
+    const std::vector<double>& sample(SimulationContext::RngTy& rng)
+    {
+        std::normal_distribution<double> normal;
+        candidates.resize(lambda * n);
+        steps.resize(lambda * n);
+        std::vector<double> z(n);
+        for(size_t k = 0; k < lambda; ++k)
+        {
+            double* y = &steps[k * n];
+            for(size_t i = 0; i < n; ++i)
+                z[i] = D[i] * normal(rng);
+            for(size_t r = 0; r < n; ++r)
+            {
+                if( covariance == SEPARABLE )
+                    y[r] = z[r];
+                else
+                {
+                    y[r] = 0.0;
+                    for(size_t c = 0; c < n; ++c)
+                        y[r] += B[r * n + c] * z[c];
+                }
+                candidates[k * n + r] = mean[r] + sigma * y[r];
+            }
+        }
+        return candidates;
+    }
+//the fitness of each candidate of the last batch, higher being better and
+//    NaN the worst there is
+    void update(const std::vector<double>& fitness)
+    {
+        std::vector<size_t> order(lambda);
+        std::iota(order.begin(), order.end(), 0);
+        auto value = [&](size_t k) {
+            double f = k < fitness.size() ? fitness[k] : -std::numeric_limits<double>::infinity();
+            return f == f ? f : -std::numeric_limits<double>::infinity();
+        };
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {return value(a) > value(b);});
+        if( candidates.size() == lambda * n and value(order[0]) > bestFitness )
+        {
+            bestFitness = value(order[0]);
+            best.assign(candidates.begin() + order[0] * n, candidates.begin() + (order[0] + 1) * n);
+        }
+        std::vector<double> yw(n, 0.0);
+        for(size_t i = 0; i < mu; ++i)
+            for(size_t r = 0; r < n; ++r)
+                yw[r] += weights[i] * steps[order[i] * n + r];
+        for(size_t r = 0; r < n; ++r)
+            mean[r] += sigma * yw[r];
+        //the step as it would be under an identity covariance: B D^-1 B^T yw
+        std::vector<double> white(n);
+        if( covariance == SEPARABLE )
+            for(size_t r = 0; r < n; ++r)
+                white[r] = yw[r] / D[r];
+        else
+        {
+            std::vector<double> t(n, 0.0);
+            for(size_t c = 0; c < n; ++c)
+            {
+                for(size_t r = 0; r < n; ++r)
+                    t[c] += B[r * n + c] * yw[r];
+                t[c] /= D[c];
+            }
+            for(size_t r = 0; r < n; ++r)
+            {
+                white[r] = 0.0;
+                for(size_t c = 0; c < n; ++c)
+                    white[r] += B[r * n + c] * t[c];
+            }
+        }
+        double psNorm = 0.0;
+        for(size_t r = 0; r < n; ++r)
+        {
+            ps[r] = (1.0 - cs) * ps[r] + std::sqrt(cs * (2.0 - cs) * mueff) * white[r];
+            psNorm += ps[r] * ps[r];
+        }
+        psNorm = std::sqrt(psNorm);
+        //stall the evolution path while the step size is growing fast, so
+        //    that the covariance does not grow along with it
+        bool hsig = psNorm / std::sqrt(1.0 - std::pow(1.0 - cs, 2.0 * (generation + 1))) / chiN < 1.4 + 2.0 / (n + 1.0);
+        for(size_t r = 0; r < n; ++r)
+            pc[r] = (1.0 - cc) * pc[r] + (hsig ? std::sqrt(cc * (2.0 - cc) * mueff) : 0.0) * yw[r];
+        double keep = 1.0 - c1 - cmu + (hsig ? 0.0 : c1 * cc * (2.0 - cc));
+        if( covariance == SEPARABLE )
+            for(size_t r = 0; r < n; ++r)
+            {
+                double rankMu = 0.0;
+                for(size_t i = 0; i < mu; ++i)
+                    rankMu += weights[i] * steps[order[i] * n + r] * steps[order[i] * n + r];
+                C[r] = keep * C[r] + c1 * pc[r] * pc[r] + cmu * rankMu;
+            }
+        else
+            for(size_t r = 0; r < n; ++r)
+                for(size_t c = 0; c <= r; ++c)
+                {
+                    double rankMu = 0.0;
+                    for(size_t i = 0; i < mu; ++i)
+                        rankMu += weights[i] * steps[order[i] * n + r] * steps[order[i] * n + c];
+                    C[r * n + c] = C[c * n + r] = keep * C[r * n + c] + c1 * pc[r] * pc[c] + cmu * rankMu;
+                }
+        sigma *= std::exp((cs / ds) * (psNorm / chiN - 1.0));
+        ++generation;
+        if( covariance == SEPARABLE or generation - eigenGeneration >= eigenEvery )
+            refreshEigen();
+    }
+};
+
+//tunes the continuous parameters of one creature by CMA-ES, keeping its
+//    topology.  Every candidate of a batch has that same topology, so each
+//    worker keeps one copy of the creature with its parameters looked up
+//    once, and just writes the next candidate's values into it before
+//    handing it to the evaluator, rather than building a creature per
+//    candidate
+class ParameterTuner {
+public:
+    struct GenerationReport {
+        size_t generation;
+        double bestFitness, meanFitness, sigma;
+    };
+private:
+    Evaluator& evaluator;
+    ThreadPool* pool;
+    Creature base;
+    ParameterSpace space;
+    Cmaes cmaes;
+    SimulationContext::RngTy rng;
+    Evaluator::SeedTy seed;
+    std::vector<Creature> workspaces;
+    std::vector<ParameterSpace::Binding> bindings;
+    static std::vector<double> startOf(const ParameterSpace& space, Creature& creature)
+    {
+        ParameterSpace::Binding binding;
+        space.bind(creature, binding);
+        return space.read(binding);
+    }
+public:
+//sigma is the first step size, relative to ParameterSpace::scales()
+    ParameterTuner(Evaluator& e, const Creature& creature, ThreadPool* p = nullptr, double sigma = 0.3,
+                   Cmaes::CovarianceTy covariance = Cmaes::AUTOMATIC, size_t populationSize = 0,
+                   SimulationContext::RngTy::result_type rngSeed = SimulationContext::RngTy::default_seed) :
+        evaluator(e), pool(p), base(creature), space(ParameterSpace::of(base)),
+        cmaes(startOf(space, base), sigma, covariance, populationSize, space.scales(startOf(space, base))),
+        rng(rngSeed), seed(SimulationContext::RngTy::default_seed)
+    {
+        //bound only once all are made, so that none of them move afterwards
+        workspaces.assign(pool ? pool->getThreadCount() : 1, base);
+        bindings.resize(workspaces.size());
+        for(size_t w = 0; w < workspaces.size(); ++w)
+            space.bind(workspaces[w], bindings[w]);
+    }
+    void setEvaluationSeed(Evaluator::SeedTy s) {seed = s;}
+    const ParameterSpace& getSpace() const {return space;}
+    const Cmaes& getCmaes() const {return cmaes;}
+//evaluate count packed parameter vectors, split across the pool
+    void evaluate(const std::vector<double>& vectors, std::vector<Evaluation>& results)
+    {
+        size_t count = space.size() ? vectors.size() / space.size() : 0;
+        results.resize(count);
+        auto run = [&](size_t begin, size_t end, unsigned thread) {
+            for(size_t i = begin; i < end; ++i)
+            {
+                space.apply(bindings[thread], &vectors[i * space.size()]);
+                results[i] = evaluator.evaluate(workspaces[thread], seed);
+            }
+        };
+        if( pool )
+            pool->parallelFor(count, run);
+        else
+            run(0, count, 0);
+    }
+//sample, evaluate and learn from one batch
+    GenerationReport step()
+    {
+        GenerationReport report = {cmaes.getGeneration(), cmaes.getBestFitness(), 0.0, cmaes.getSigma()};
+        if( space.size() == 0 ) return report;
+        std::vector<Evaluation> results;
+        evaluate(cmaes.sample(rng), results);
+        std::vector<double> fitness(results.size());
+        for(size_t i = 0; i < results.size(); ++i)
+        {
+            fitness[i] = results[i].fitness;
+            report.meanFitness += fitness[i] / results.size();
+        }
+        cmaes.update(fitness);
+        report.generation = cmaes.getGeneration();
+        report.bestFitness = cmaes.getBestFitness();
+        report.sigma = cmaes.getSigma();
+        return report;
+    }
+//run up to generations batches, stopping early once the search has
+//    narrowed to less than tolerance in every parameter
+    GenerationReport run(size_t generations, double tolerance = 1e-9)
+    {
+        GenerationReport report = {cmaes.getGeneration(), cmaes.getBestFitness(), 0.0, cmaes.getSigma()};
+        for(size_t g = 0; g < generations and space.size() and cmaes.getSpread() >= tolerance; ++g)
+            report = step();
+        return report;
+    }
+//the creature with the best parameters found so far (or as given, before
+//    the first batch)
+    Creature getBest() const
+    {
+        Creature best = base;
+        if( cmaes.getGeneration() > 0 ) space.apply(cmaes.getBest(), best);
+        return best;
+    }
+};
+
+}; //namespace EVOL_NS
+
+#endif
@@ -4,19 +4,98 @@
 #include "config.h"
 #include <string>
 #include <map>
+#include <sstream>
 #include "Axon.h"
 #include "BodyPart.h"
+#include "Bone.h"
+#include "Force.h"
+#include "Muscle.h"
+#include "PartBatches.h"
+#include "SimulationContext.h"
 
 namespace EVOL_NS {
 
 class Creature {
     std::map<std::string,BodyPartPtr> parts;
+//the physical points that muscles are connected between
+    std::map<std::string,PositionableObjectPtr> nodes;
+//the finalized form of our parts, used for updating; thrown away whenever
+//    parts or connections change and rebuilt on the next update
+    PartBatches batches;
+    bool batchesValid;
+//the world the batches read physics state from
+    const PhysicsWorld* batchesWorld;
+    void invalidate()
+    {
+        batches.clear();
+        batchesValid = false;
+    }
+//make this creature a deep copy of other, with every link between parts and
+//    nodes pointing at the copies rather than the originals
+    void copyFrom(const Creature& other)
+    {
+        std::map<PositionableObject*,PositionableObjectPtr> nodeCopies;
+        for(auto NI : other.nodes)
+        {
+            PositionableObjectPtr copy = NI.second->clone();
+            nodeCopies[NI.second.get()] = copy;
+            nodes[NI.first] = copy;
+        }
+        std::map<BodyPart*,BodyPartPtr> partCopies;
+        std::map<Axon*,AxonPtr> axonCopies;
+        for(auto BI : other.parts)
+        {
+            BodyPartPtr copy = BI.second->clone();
+            partCopies[BI.second.get()] = copy;
+            if( AxonPtr axe = std::dynamic_pointer_cast<Axon>(copy) )
+                axonCopies[std::dynamic_pointer_cast<Axon>(BI.second).get()] = axe;
+            parts[BI.first] = copy;
+        }
+        for(auto BI : parts)
+        {
+            if( CanHaveAxonInputsPtr base = std::dynamic_pointer_cast<CanHaveAxonInputs>(BI.second) )
+                base->remapInputs(axonCopies);
+            BI.second->remapLinks(partCopies, nodeCopies);
+        }
+    }
 public:
-    void add(std::string name, BodyPartPtr part) {parts[name] = part;}
+    Creature() : batchesValid(false), batchesWorld(nullptr) {}
+//creatures are values: a copy shares no state with the original, so the two
+//    can be simulated independently
+    Creature(const Creature& other) : batchesValid(false), batchesWorld(nullptr) { copyFrom(other); }
+    Creature(Creature&&) = default;
+    Creature& operator = (const Creature& other)
+    {
+        if( this != &other )
+        {
+            invalidate();
+            parts.clear();
+            nodes.clear();
+            copyFrom(other);
+        }
+        return *this;
+    }
+    Creature& operator = (Creature&& other)
+    {
+        invalidate();
+        parts = std::move(other.parts);
+        nodes = std::move(other.nodes);
+        other.invalidate();
+        return *this;
+    }
+    void add(std::string name, BodyPartPtr part) {invalidate(); parts[name] = part;}
     void add(std::string name, BodyPart* part) {add(name, BodyPartPtr(part));}
+    void addNode(std::string name, PositionableObjectPtr node) {nodes[name] = node;}
+    void addNode(std::string name, PositionableObject* node) {addNode(name, PositionableObjectPtr(node));}
 //accessors
     decltype(parts)::iterator begin() {return parts.begin();}
     decltype(parts)::iterator end() {return parts.end();}
+    decltype(nodes)::iterator nodeBegin() {return nodes.begin();}
+    decltype(nodes)::iterator nodeEnd() {return nodes.end();}
+    decltype(parts)::const_iterator begin() const {return parts.begin();}
+    decltype(parts)::const_iterator end() const {return parts.end();}
+    decltype(nodes)::const_iterator nodeBegin() const {return nodes.begin();}
+    decltype(nodes)::const_iterator nodeEnd() const {return nodes.end();}
     BodyPartPtr getPartNamed(std::string name)
     {
         auto result = parts.find(name);
@@ -29,26 +108,95 @@ public:
     {
         return std::dynamic_pointer_cast<Axon>(getPartNamed(name));
     }
+    PositionableObjectPtr getNodeNamed(std::string name)
+    {
+        auto result = nodes.find(name);
+        if( result == nodeEnd() )
+            return PositionableObjectPtr();
+        else
+            return result->second;
+    }
 //connections
     bool addAxonAsInputTo(std::string input, std::string base)
     {
         AxonPtr inAxon = getAxonNamed(input);
         CanHaveAxonInputsPtr basePart = std::dynamic_pointer_cast<CanHaveAxonInputs>(getPartNamed(base));
         if( !inAxon or !basePart ) return false; //we failed to make connnection
+        invalidate();
         basePart->addAxonAsInput(inAxon);
         return true;
     }
-//state update
-    void update()
+    bool connectMuscle(std::string muscle, std::string nodeA, std::string nodeB)
     {
+        MusclePtr musc = std::dynamic_pointer_cast<Muscle>(getPartNamed(muscle));
+        PositionableObjectPtr a = getNodeNamed(nodeA);
+        PositionableObjectPtr b = getNodeNamed(nodeB);
+        if( !musc or !a or !b ) return false; //we failed to make connnection
+        musc->connectEnds(a, b);
+        return true;
+    }
+    bool connectBone(std::string bone, std::string nodeA, std::string nodeB)
+    {
+        BonePtr bonePart = std::dynamic_pointer_cast<Bone>(getPartNamed(bone));
+        PositionableObjectPtr a = getNodeNamed(nodeA);
+        PositionableObjectPtr b = getNodeNamed(nodeB);
+        if( !bonePart or !a or !b ) return false; //we failed to make connnection
+        bonePart->connectEnds(a, b);
+        return true;
+    }
+//put our nodes, and the muscles and bones between them, into the physics world of a simulation
+    void addToWorld(PhysicsWorld& world)
+    {
+        invalidate();
+        for(auto NI : nodes)
+            world.add(NI.second);
         for(auto BI : parts)
-            BI.second->update();
+        {
+            if( MusclePtr musc = std::dynamic_pointer_cast<Muscle>(BI.second) )
+                world.add(musc);
+            if( BonePtr bone = std::dynamic_pointer_cast<Bone>(BI.second) )
+                world.add(bone);
+        }
+    }
+//build the flat form used for updating; update() does this when needed.
+//    Inputs added to a part directly, rather than through addAxonAsInputTo(),
+//    are not seen until the creature next changes
+    void finalize(const PhysicsWorld& world)
+    {
+        if( batchesValid and batchesWorld == &world ) return;
+        batches.build(parts, world);
+        batchesValid = true;
+        batchesWorld = &world;
+    }
+//state update
+    void update(SimulationContext& ctx)
+    {
+        finalize(ctx.getWorld());
+        batches.update(ctx);
+        batches.commit();
+    }
+//send our current state to the context's trace sink, if it has one
+    void trace(SimulationContext& ctx)
+    {
+        if( !ctx.isTracing() ) return;
+        TraceSink& sink = ctx.getTraceSink();
+        sink.beginTick(ctx.getTicks());
         for(auto BI : parts)
-            BI.second->commit();
+        {
+            std::stringstream value;
+            if( AxonPtr axe = std::dynamic_pointer_cast<Axon>(BI.second) ) value << axe->getOutputValue();
+            if( MusclePtr musc = std::dynamic_pointer_cast<Muscle>(BI.second) ) value << musc->getMuscleLength();
+            sink.record(BI.first, BI.second->getTypeAsString(), value.str());
+        }
+        for(auto NI : nodes)
+        {
+            std::stringstream value;
+            value << "(" << NI.second->getPosX() << ", " << NI.second->getPosY() << ")";
+            sink.record(NI.first, "", value.str());
+        }
     }
 };
 
 }; //namespace EVOL_NS
 
 #endif
-
@@ -0,0 +1,265 @@
+#ifndef _EVALUATION_H__
+#define _EVALUATION_H__
+
+#include "config.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <vector>
+#include "Creature.h"
+#include "FitnessCache.h"
+#include "GenomeHash.h"
+#include "SimulationContext.h"
+#include "ThreadPool.h"
+
+namespace EVOL_NS {
+
+//makes a child from a parent, e.g. by mutating a copy of it; the search
+//    methods take one of these and leave what a mutation is to the caller
+typedef std::function<Creature(const Creature&, SimulationContext::RngTy&)> VariationFn;
+
+//when an evaluation may be given up before its last tick.  Every interval
+//    ticks (after the first grace ticks) the bound function is asked for the
+//    best fitness the run could still end with; once that is below the
+//    evaluator's threshold by more than margin, the run stops.  With a bound
+//    that truly is one and a margin of 0 no candidate that could have won is
+//    ever stopped; a bound that is only an estimate can be given room with a
+//    larger margin.  A NaN bound stops the run too
+struct TerminationPolicy {
+//gets the creature, its context and the ticks left to run
+    typedef std::function<double(Creature&, SimulationContext&, int)> BoundFn;
+    BoundFn bound;
+    int interval, grace;
+    double margin;
+//also stop a world whose energy passes this many joules or that stops being
+//    finite; 0 stops on NaN only, and a negative limit leaves the world alone
+    double divergenceEnergy;
+    TerminationPolicy(BoundFn b = BoundFn(), int every = 100, int wait = 0, double m = 0.0, double energy = 0.0) :
+        bound(b), interval(every), grace(wait), margin(m), divergenceEnergy(energy) {}
+};
+
+//runs a creature alone in a fresh simulation for a number of ticks and
+//    scores it.  The creature is copied first, so the one given is untouched
+//    and can be evaluated again, from any thread
+class Evaluator {
+public:
+    typedef SimulationContext::RngTy::result_type SeedTy;
+//prepares the world (terrain, fields, ...) before the creature is added
+    typedef std::function<void(SimulationContext&)> SetupFn;
+//the score of the creature at the end of the run
+    typedef std::function<double(Creature&, SimulationContext&)> FitnessFn;
+//fills in the behaviour descriptor at the end of the run
+    typedef std::function<void(Creature&, SimulationContext&, std::vector<double>&)> BehaviourFn;
+//fills in the objectives at the end of the run, for multi-objective search
+    typedef std::function<void(Creature&, SimulationContext&, std::vector<double>&)> ObjectivesFn;
+//a run under way, kept so that it can be taken further later rather than
+//    started over
+    class Simulation {
+        friend class Evaluator;
+        Creature creature;
+        SimulationContext ctx;
+        Evaluation result;
+        Simulation(const Creature& c, SeedTy seed) : creature(c), ctx(seed) {}
+    public:
+//the creature is in the context's world, so the two cannot be copied apart
+        Simulation(const Simulation&) = delete;
+        Simulation& operator = (const Simulation&) = delete;
+        int getTicks() const {return ctx.getTicks();}
+//how the run stands as of the last advance()
+        const Evaluation& getResult() const {return result;}
+    };
+private:
+    int ticks;
+    FitnessFn fitness;
+    SetupFn setup;
+    BehaviourFn behaviour;
+    ObjectivesFn objectives;
+    FitnessCache* cache;
+    uint64_t environment;
+    TerminationPolicy policy;
+//an atomic that can be copied, so that the evaluator still can be
+    struct Threshold {
+        std::atomic<double> value;
+        Threshold(double v) : value(v) {}
+        Threshold(const Threshold& other) : value(other.value.load()) {}
+    };
+    Threshold threshold;
+    FitnessCache::Key keyOf(const Creature& creature, SeedTy seed) const
+    {
+        FitnessCache::Key key = {genomeHash(creature), Hasher(environment).add(uint64_t(ticks)).get(), seed};
+        return key;
+    }
+//runs stopped on the threshold depended on it; diverging depends on the
+//    creature alone
+    static bool cacheable(const Evaluation& result) {return !result.terminated or result.diverged;}
+    Evaluation simulate(const Creature& creature, SeedTy seed) const
+    {
+        std::unique_ptr<Simulation> run = start(creature, seed);
+        advance(*run, ticks);
+        return finish(*run);
+    }
+public:
+    Evaluator(int t, FitnessFn f) : ticks(t), fitness(f), cache(nullptr), environment(0),
+        policy(TerminationPolicy::BoundFn(), 100, 0, 0.0, -1.0), threshold(-std::numeric_limits<double>::infinity()) {}
+    int getTicks() const {return ticks;}
+    void setTicks(int t) {ticks = t;}
+    void setSetup(SetupFn fn) {setup = fn;}
+    void setBehaviour(BehaviourFn fn) {behaviour = fn;}
+    bool hasBehaviour() const {return (bool)behaviour;}
+    void setObjectives(ObjectivesFn fn) {objectives = fn;}
+    bool hasObjectives() const {return (bool)objectives;}
+//look evaluations up in c before simulating, and remember new ones there.
+//    The setup, fitness, behaviour and objectives functions cannot be told
+//    apart by looking at them, so env must be a number that changes whenever
+//    they do; the tick count is added to it here.  Creatures are looked up
+//    by genomeHash(), which ignores names, so none of those functions may
+//    depend on what parts or nodes are called (finding a part by name to
+//    read it is fine only if every creature names it the same)
+    void setCache(FitnessCache* c, uint64_t env = 0) {cache = c; environment = env;}
+    FitnessCache* getCache() const {return cache;}
+//stop runs early as p says; by default none are, and worlds are not watched
+//    for divergence
+    void setTermination(const TerminationPolicy& p) {policy = p;}
+    const TerminationPolicy& getTermination() const {return policy;}
+//the fitness a candidate has to be able to reach to be worth finishing, e.g.
+//    the worst of the population it would join.  Can be moved from any
+//    thread while evaluations run
+    void setThreshold(double t) {threshold.value.store(t, std::memory_order_relaxed);}
+    double getThreshold() const {return threshold.value.load(std::memory_order_relaxed);}
+//set up a run of a copy of creature, with the context seeded by seed, at
+//    tick 0
+    std::unique_ptr<Simulation> start(const Creature& creature, SeedTy seed) const
+    {
+        std::unique_ptr<Simulation> run(new Simulation(creature, seed));
+        if( setup ) setup(run->ctx);
+        if( policy.divergenceEnergy >= 0 )
+            run->ctx.getWorld().setDivergenceLimit(units::energy::joule_t(policy.divergenceEnergy));
+        run->creature.addToWorld(run->ctx.getWorld());
+        return run;
+    }
+//run on until tick until (but no further than getTicks()), and score the
+//    creature where it has got to.  False once the run is over: all ticks
+//    done, its world diverged, or it was terminated.  A diverged run is
+//    terminated too, with a fitness of -infinity
+    bool advance(Simulation& run, int until) const
+    {
+        Creature& copy = run.creature;
+        SimulationContext& ctx = run.ctx;
+        Evaluation& result = run.result;
+        until = std::min(until, ticks);
+        bool checking = policy.bound and policy.interval > 0;
+        for(; ctx.getTicks() < until and !ctx.getWorld().hasDiverged() and !result.terminated; ctx.advanceTick())
+        {
+            copy.update(ctx);
+            ctx.getWorld().update();
+            int done = ctx.getTicks() + 1;
+            if( !checking or done < policy.grace or done % policy.interval != 0 or done == ticks ) continue;
+            double bound = policy.bound(copy, ctx, ticks - done);
+            if( bound != bound or bound < threshold.value.load(std::memory_order_relaxed) - policy.margin )
+            {
+                result.fitness = bound;
+                result.terminated = true;
+            }
+        }
+        result.ticks = ctx.getTicks();
+        result.diverged = ctx.getWorld().hasDiverged();
+        //a world that blew up says nothing about the creature, so it is not scored
+        if( result.diverged )
+        {
+            result.fitness = -std::numeric_limits<double>::infinity();
+            result.terminated = true;
+        }
+        else if( !result.terminated ) result.fitness = fitness(copy, ctx);
+        return ctx.getTicks() < ticks and !result.diverged and !result.terminated;
+    }
+//end the run where it is: describe its behaviour and objectives, and give
+//    the result.  A diverged run gets neither, for the same reason it gets no
+//    fitness: an exploded world would only give far out values that look
+//    novel or Pareto optimal
+    Evaluation finish(Simulation& run) const
+    {
+        if( run.result.diverged ) return run.result;
+        if( behaviour ) behaviour(run.creature, run.ctx, run.result.behaviour);
+        if( objectives ) objectives(run.creature, run.ctx, run.result.objectives);
+        return run.result;
+    }
+//what the cache holds for creature under seed; false if there is no cache
+//    or nothing in it
+    bool lookup(const Creature& creature, SeedTy seed, Evaluation& out) const
+    {
+        return cache and cache->find(keyOf(creature, seed), out);
+    }
+//put a full run's result in the cache, if there is one
+    void remember(const Creature& creature, SeedTy seed, const Evaluation& result) const
+    {
+        if( cache and cacheable(result) ) cache->insert(keyOf(creature, seed), result);
+    }
+//simulate a copy of creature, with the context seeded by seed.  Runs that
+//    were stopped early on the threshold depended on it, so are never
+//    cached; diverged ones are
+    Evaluation evaluate(const Creature& creature, SeedTy seed = SimulationContext::RngTy::default_seed) const
+    {
+        if( !cache ) return simulate(creature, seed);
+        FitnessCache::Key key = keyOf(creature, seed);
+        Evaluation result;
+        if( cache->find(key, result) ) return result;
+        result = simulate(creature, seed);
+        if( cacheable(result) ) cache->insert(key, result);
+        return result;
+    }
+//evaluate every creature of a population, split across pool if given; all
+//    of them see the same seed
+    void evaluate(const std::vector<Creature>& population, std::vector<Evaluation>& results,
+                  ThreadPool* pool = nullptr, SeedTy seed = SimulationContext::RngTy::default_seed) const
+    {
+        results.resize(population.size());
+        auto run = [&](size_t begin, size_t end, unsigned) {
+            for(size_t i = begin; i < end; ++i)
+                results[i] = evaluate(population[i], seed);
+        };
+        if( pool )
+            pool->parallelFor(population.size(), run);
+        else
+            run(0, population.size(), 0);
+    }
+};
+
+//a bound for fitness functions that can gain at most rate per tick: what
+//    now gives at present, plus rate for every tick left
+inline TerminationPolicy::BoundFn rateBound(Evaluator::FitnessFn now, double rate)
+{
+    return [now, rate](Creature& creature, SimulationContext& ctx, int remaining) {
+        return now(creature, ctx) + rate * remaining;
+    };
+}
+
+//a behaviour function giving where count of the creature's nodes ended up:
+//    nodes spread evenly through them in order of where they ended up (by x,
+//    then y, then z; repeating some if there are fewer than count), each
+//    contributing one value per dimension, so that every creature gets a
+//    descriptor of the same length.  Names play no part, so creatures the
+//    fitness cache takes for the same get the same descriptor
+inline Evaluator::BehaviourFn finalPositions(unsigned count)
+{
+    return [count](Creature& creature, SimulationContext&, std::vector<double>& out) {
+        std::vector<std::array<double,3>> nodes;
+        for(auto NI = creature.nodeBegin(); NI != creature.nodeEnd(); ++NI)
+            nodes.push_back(std::array<double,3>{{NI->second->getPosX()(), NI->second->getPosY()(), NI->second->getPosZ()()}});
+        std::sort(nodes.begin(), nodes.end());
+        out.assign(count * EVOL_DIMENSIONS, 0.0);
+        if( nodes.empty() ) return;
+        for(unsigned i = 0; i < count; ++i)
+        {
+            const std::array<double,3>& pos = nodes[count > 1 ? i * (nodes.size() - 1) / (count - 1) : 0];
+            for(unsigned d = 0; d < EVOL_DIMENSIONS; ++d)
+                out[i * EVOL_DIMENSIONS + d] = pos[d];
+        }
+    };
+}
+
+}; //namespace EVOL_NS
+
+#endif
@@ -0,0 +1,204 @@
+#ifndef _FITNESS_CACHE_H__
+#define _FITNESS_CACHE_H__
+
+#include "config.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace EVOL_NS {
+
+//what one simulation of a creature came to
+struct Evaluation {
+    double fitness;
+//a fixed length description of what the creature did, for novelty and
+//    quality-diversity; empty unless the evaluator has a behaviour function
+//    (or the run diverged)
+    std::vector<double> behaviour;
+//the values of each objective, for multi-objective selection; empty unless
+//    the evaluator has an objectives function (or the run diverged)
+    std::vector<double> objectives;
+//how long it ran, and whether its world blew up before the end
+    int ticks;
+    bool diverged;
+//whether it was stopped early, for being unable to beat the evaluator's
+//    threshold, for losing a race or because its world diverged; its
+//    fitness is then the bound it was stopped on, its score when it was
+//    dropped, or -infinity
+    bool terminated;
+    Evaluation() : fitness(0.0), ticks(0), diverged(false), terminated(false) {}
+};
+
+//remembers evaluations by (genome hash, environment, seed), so a creature
+//    seen before in the same conditions need not be simulated again.  Keeps
+//    at most a fixed number, forgetting the least recently used first.  Keys
+//    are spread over striped locks like EliteGrid's cells, each stripe with
+//    its own share of the capacity, so many threads can use it at once
+class FitnessCache {
+public:
+    struct Key {
+        uint64_t genome;
+//stands for everything else that decides the result: setup, fitness
+//    function, ticks; the caller picks it
+        uint64_t environment;
+        uint64_t seed;
+        bool operator == (const Key& other) const
+        {
+            return genome == other.genome and environment == other.environment and seed == other.seed;
+        }
+    };
+private:
+    struct KeyHash {
+        size_t operator () (const Key& k) const
+        {
+            return size_t(k.genome ^ (k.environment * 0x9e3779b97f4a7c15ULL) ^ (k.seed * 0xc2b2ae3d27d4eb4fULL));
+        }
+    };
+    typedef std::list<std::pair<Key,Evaluation>> Entries;
+//most recently used first
+    struct Stripe {
+        std::mutex mutex;
+        Entries entries;
+        std::unordered_map<Key,Entries::iterator,KeyHash> index;
+        char padding[64];
+    };
+    std::unique_ptr<Stripe[]> stripes;
+    size_t stripeCount, stripeCapacity;
+    std::atomic<size_t> hits, misses;
+    Stripe& stripeOf(const Key& key) const {return stripes[KeyHash()(key) % stripeCount];}
+    static const char* magic() {return "EVOLFIT3";}
+    template<class T> static void write(std::ofstream& out, const T& v) {out.write((const char*)&v, sizeof(v));}
+    template<class T> static bool read(std::ifstream& in, T& v) {return bool(in.read((char*)&v, sizeof(v)));}
+public:
+    FitnessCache(size_t capacity = 1 << 16, size_t locks = 64) :
+        stripeCount(std::max<size_t>(1, locks)), stripeCapacity(std::max<size_t>(1, capacity / stripeCount)), hits(0), misses(0)
+    {
+        stripes.reset(new Stripe[stripeCount]);
+    }
+    size_t getCapacity() const {return stripeCapacity * stripeCount;}
+    size_t size() const
+    {
+        size_t total = 0;
+        for(size_t s = 0; s < stripeCount; ++s)
+        {
+            std::lock_guard<std::mutex> lock(stripes[s].mutex);
+            total += stripes[s].index.size();
+        }
+        return total;
+    }
+    size_t getHits() const {return hits.load();}
+    size_t getMisses() const {return misses.load();}
+//the evaluation remembered under key, into out; false if there is none
+    bool find(const Key& key, Evaluation& out)
+    {
+        Stripe& stripe = stripeOf(key);
+        std::lock_guard<std::mutex> lock(stripe.mutex);
+        auto result = stripe.index.find(key);
+        if( result == stripe.index.end() )
+        {
+            ++misses;
+            return false;
+        }
+        stripe.entries.splice(stripe.entries.begin(), stripe.entries, result->second);
+        out = result->second->second;
+        ++hits;
+        return true;
+    }
+//remember evaluation under key, replacing anything there
+    void insert(const Key& key, const Evaluation& evaluation)
+    {
+        Stripe& stripe = stripeOf(key);
+        std::lock_guard<std::mutex> lock(stripe.mutex);
+        auto result = stripe.index.find(key);
+        if( result != stripe.index.end() )
+        {
+            result->second->second = evaluation;
+            stripe.entries.splice(stripe.entries.begin(), stripe.entries, result->second);
+            return;
+        }
+        stripe.entries.emplace_front(key, evaluation);
+        stripe.index[key] = stripe.entries.begin();
+        if( stripe.index.size() > stripeCapacity )
+        {
+            stripe.index.erase(stripe.entries.back().first);
+            stripe.entries.pop_back();
+        }
+    }
+    void clear()
+    {
+        for(size_t s = 0; s < stripeCount; ++s)
+        {
+            std::lock_guard<std::mutex> lock(stripes[s].mutex);
+            stripes[s].entries.clear();
+            stripes[s].index.clear();
+        }
+    }
+//write every entry to a file, least recently used first so that load()
+//    brings back the same order; in this machine's byte order.  False if the
+//    file could not be written
+    bool save(const std::string& path) const
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if( !out ) return false;
+        out.write(magic(), std::strlen(magic()));
+        for(size_t s = 0; s < stripeCount; ++s)
+        {
+            std::lock_guard<std::mutex> lock(stripes[s].mutex);
+            for(auto EI = stripes[s].entries.rbegin(); EI != stripes[s].entries.rend(); ++EI)
+            {
+                const Evaluation& e = EI->second;
+                write(out, EI->first.genome);
+                write(out, EI->first.environment);
+                write(out, EI->first.seed);
+                write(out, e.fitness);
+                write(out, int32_t(e.ticks));
+                write(out, uint8_t(e.diverged));
+                write(out, uint8_t(e.terminated));
+                write(out, uint32_t(e.behaviour.size()));
+                out.write((const char*)e.behaviour.data(), e.behaviour.size() * sizeof(double));
+                write(out, uint32_t(e.objectives.size()));
+                out.write((const char*)e.objectives.data(), e.objectives.size() * sizeof(double));
+            }
+        }
+        return bool(out);
+    }
+//add the entries of a file written by save(); false if it could not be read
+//    or is not such a file, though whatever came before the problem is kept
+    bool load(const std::string& path)
+    {
+        std::ifstream in(path, std::ios::binary);
+        char header[8];
+        if( !in.read(header, sizeof(header)) or std::memcmp(header, magic(), sizeof(header)) != 0 ) return false;
+        for(;;)
+        {
+            Key key;
+            Evaluation e;
+            int32_t ticks;
+            uint8_t diverged, terminated;
+            uint32_t behaviourSize, objectiveCount;
+            if( !read(in, key.genome) ) return in.gcount() == 0;
+            if( !read(in, key.environment) or !read(in, key.seed) or !read(in, e.fitness) or
+                !read(in, ticks) or !read(in, diverged) or !read(in, terminated) or !read(in, behaviourSize) ) return false;
+            e.behaviour.resize(behaviourSize);
+            if( !in.read((char*)e.behaviour.data(), behaviourSize * sizeof(double)) or !read(in, objectiveCount) ) return false;
+            e.objectives.resize(objectiveCount);
+            if( !in.read((char*)e.objectives.data(), objectiveCount * sizeof(double)) ) return false;
+            e.ticks = ticks;
+            e.diverged = diverged != 0;
+            e.terminated = terminated != 0;
+            insert(key, e);
+        }
+    }
+};
+
+}; //namespace EVOL_NS
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef _FIXED_H__
+#define _FIXED_H__
+
+#include "config.h"
+#include <cmath>
+#include <cstdint>
+
+namespace EVOL_NS {
+
+//a signed Q32.32 fixed point number.  All arithmetic is done in integers,
+//    and conversion to and from double is exact or correctly rounded, so a
+//    calculation in Fixed gives the same bits on any machine.  Addition and
+//    subtraction wrap around on overflow, which keeps them associative: a sum
+//    comes out the same in any order, however it is split between threads.
+//    Products round to nearest, quotients truncate, and both saturate
+class Fixed {
+    int64_t raw;
+    static int64_t saturate(__int128 wide)
+    {
+        if( wide > INT64_MAX ) return INT64_MAX;
+        if( wide < INT64_MIN ) return INT64_MIN;
+        return int64_t(wide);
+    }
+public:
+    static const int FRACTION_BITS = 32;
+    Fixed() : raw(0) {}
+    explicit Fixed(int whole) : raw(int64_t(whole) * (int64_t(1) << FRACTION_BITS)) {}
+    static Fixed fromRaw(int64_t r) {Fixed f; f.raw = r; return f;}
+    int64_t getRaw() const {return raw;}
+//the nearest Fixed, saturating; NaN becomes 0
+    static Fixed fromDouble(double v)
+    {
+        double scaled = v * 4294967296.0;
+        if( scaled != scaled ) return Fixed();
+        if( scaled >= 9223372036854775807.0 ) return fromRaw(INT64_MAX);
+        if( scaled <= -9223372036854775808.0 ) return fromRaw(INT64_MIN);
+        return fromRaw(std::llround(scaled));
+    }
+    double toDouble() const {return double(raw) / 4294967296.0;}
+    Fixed operator - () const {return fromRaw(int64_t(0 - uint64_t(raw)));}
+    Fixed& operator += (Fixed o) {raw = int64_t(uint64_t(raw) + uint64_t(o.raw)); return *this;}
+    Fixed& operator -= (Fixed o) {raw = int64_t(uint64_t(raw) - uint64_t(o.raw)); return *this;}
+    Fixed& operator *= (Fixed o)
+    {
+        raw = saturate((__int128(raw) * o.raw + (__int128(1) << (FRACTION_BITS - 1))) >> FRACTION_BITS);
+        return *this;
+    }
+    Fixed& operator /= (Fixed o)
+    {
+        if( o.raw == 0 ) raw = raw < 0 ? INT64_MIN : (raw > 0 ? INT64_MAX : 0);
+        else raw = saturate(__int128(raw) * (__int128(1) << FRACTION_BITS) / o.raw);
+        return *this;
+    }
+    friend Fixed operator + (Fixed a, Fixed b) {return a += b;}
+    friend Fixed operator - (Fixed a, Fixed b) {return a -= b;}
+    friend Fixed operator * (Fixed a, Fixed b) {return a *= b;}
+    friend Fixed operator / (Fixed a, Fixed b) {return a /= b;}
+    friend bool operator == (Fixed a, Fixed b) {return a.raw == b.raw;}
+    friend bool operator != (Fixed a, Fixed b) {return a.raw != b.raw;}
+    friend bool operator < (Fixed a, Fixed b) {return a.raw < b.raw;}
+    friend bool operator > (Fixed a, Fixed b) {return a.raw > b.raw;}
+    friend bool operator <= (Fixed a, Fixed b) {return a.raw <= b.raw;}
+    friend bool operator >= (Fixed a, Fixed b) {return a.raw >= b.raw;}
+//the largest Fixed not above the square root; 0 for negatives.  The double
+//    estimate is correctly rounded, so it is the same everywhere, and is
+//    within one of the answer before being corrected in integers
+    friend Fixed sqrt(Fixed x)
+    {
+        if( x.raw <= 0 ) return Fixed();
+        unsigned __int128 n = (unsigned __int128)x.raw << FRACTION_BITS;
+        uint64_t r = uint64_t(std::sqrt(double(n)));
+        while( (unsigned __int128)r * r > n ) --r;
+        while( (unsigned __int128)(r + 1) * (r + 1) <= n ) ++r;
+        return fromRaw(int64_t(r));
+    }
+//the largest Fixed not above sqrt(a^2 + b^2), worked out on the raw values in
+//    128 bits so that nothing overflows on the way.  Past 2^52 the double
+//    estimate can be off by more than a few, and a Newton step brings it close
+//    enough for the integer correction to be short
+    friend Fixed hypot(Fixed a, Fixed b)
+    {
+        unsigned __int128 n = (unsigned __int128)(__int128(a.raw) * a.raw) + (unsigned __int128)(__int128(b.raw) * b.raw);
+        if( n == 0 ) return Fixed();
+        unsigned __int128 r = (unsigned __int128)std::sqrt(double(n));
+        if( r > (uint64_t(1) << 52) ) r = (r + n / r) / 2;
+        while( r * r > n ) --r;
+        while( (r + 1) * (r + 1) <= n ) ++r;
+        return fromRaw(r > (unsigned __int128)INT64_MAX ? INT64_MAX : int64_t(r));
+    }
+//e^x, from 2^(x log2 e) split into a shift and a series on [0, ln 2)
+    friend Fixed exp(Fixed x)
+    {
+        const Fixed LOG2E = fromRaw(6196328019), LN2 = fromRaw(2977044472);
+        if( x > Fixed(21) ) return fromRaw(INT64_MAX);
+        if( x < Fixed(-23) ) return Fixed();
+        Fixed y = x * LOG2E;
+        int64_t whole = y.raw >> FRACTION_BITS;
+        Fixed t = fromRaw(y.raw - whole * (int64_t(1) << FRACTION_BITS)) * LN2;
+        Fixed series = Fixed(1);
+        for(int k = 12; k > 0; --k)
+            series = Fixed(1) + t * series / Fixed(k);
+        if( whole >= 0 ) return fromRaw(series.raw << whole);
+        int64_t shift = -whole;
+        return fromRaw((series.raw + (int64_t(1) << (shift - 1))) >> shift);
+    }
+//the angle of (x, y) from the x axis, in (-pi, pi], by CORDIC
+    friend Fixed atan2(Fixed y, Fixed x)
+    {
+        static const int64_t ANGLES[] = {
+            3373259426, 1991351318, 1052175346, 534100635, 268086748, 134174063, 67103403, 33553749,
+            16777131, 8388597, 4194303, 2097152, 1048576, 524288, 262144, 131072,
+            65536, 32768, 16384, 8192, 4096, 2048, 1024, 512, 256, 128, 64, 32, 16, 8, 4, 2};
+        const int64_t PI = 13493037705;
+        if( x.raw == 0 and y.raw == 0 ) return Fixed();
+        //turn into the right half plane first
+        int64_t angle = 0;
+        __int128 vx = x.raw, vy = y.raw;
+        if( vx < 0 )
+        {
+            angle = vy < 0 ? -PI : PI;
+            vx = -vx;
+            vy = -vy;
+        }
+        //the angle doesn't depend on scale, so bring the vector to a size
+        //    with room to grow and enough bits to be accurate
+        __int128 size = (vx > (vy < 0 ? -vy : vy)) ? vx : (vy < 0 ? -vy : vy);
+        while( size >= (__int128(1) << 61) ) {vx >>= 1; vy >>= 1; size >>= 1;}
+        while( size < (__int128(1) << 60) ) {vx *= 2; vy *= 2; size *= 2;}
+        for(int i = 0; i < 32; ++i)
+        {
+            __int128 nx;
+            if( vy > 0 )
+            {
+                nx = vx + (vy >> i);
+                vy -= vx >> i;
+                angle += ANGLES[i];
+            }
+            else
+            {
+                nx = vx - (vy >> i);
+                vy += vx >> i;
+                angle -= ANGLES[i];
+            }
+            vx = nx;
+        }
+        return fromRaw(angle);
+    }
+};
+
+}; //namespace EVOL_NS
+
+#endif
@@ -14,18 +14,30 @@ const units::time::second_t TIME_RATE(0.001_s);
 
 typedef units::dimensionless::scalar_t ScalarTy;
 
-template<typename Ty>
+//the most dimensions any world can have; PositionableObjects and NodeArrays
+//    always have room for this many, and a world uses as many as it needs
+const unsigned MAX_DIMENSIONS = 3;
+
+template<typename Ty, unsigned Dims = EVOL_DIMENSIONS>
 class Vector {
 public:
     typedef Ty UnitTy;
+    static const unsigned DIMENSIONS = Dims;
 private:
 //a vector in our space
-    UnitTy fx, fy;
+    UnitTy components[Dims];
 public:
-    Vector() : fx(0.0), fy(0.0) {}
-    Vector(UnitTy _fx, UnitTy _fy) : fx(_fx), fy(_fy) {}
-    UnitTy getX() const {return fx;}
-    UnitTy getY() const {return fy;}
+    Vector() {for(unsigned d = 0; d < Dims; ++d) components[d] = UnitTy(0.0);}
+//z is dropped in 2D
+    Vector(UnitTy _fx, UnitTy _fy, UnitTy _fz = UnitTy(0.0))
+    {
+        const UnitTy given[] = {_fx, _fy, _fz};
+        for(unsigned d = 0; d < Dims; ++d) components[d] = given[d];
+    }
+    UnitTy get(unsigned d) const {return d < Dims ? components[d] : UnitTy(0.0);}
+    UnitTy getX() const {return components[0];}
+    UnitTy getY() const {return components[1];}
+    UnitTy getZ() const {return get(2);}
 };
 
 typedef Vector<units::force::newton_t> Force;
@@ -34,39 +46,71 @@ typedef Vector<units::acceleration::meters_per_second_squared_t> Acceleration;
 //Two or more forces just sum the dimensional components
 Force operator + (const Force& a, const Force& b)
 {
-    return Force(a.getX()+b.getX(), a.getY()+b.getY());
+    return Force(a.getX()+b.getX(), a.getY()+b.getY(), a.getZ()+b.getZ());
 }
 
 //a Vector divided by a dimensionless number is still a Vector!
-template<typename Ty>
-Vector<Ty> operator / (const Vector<Ty>& a, ScalarTy b)
+template<typename Ty, unsigned Dims>
+Vector<Ty,Dims> operator / (const Vector<Ty,Dims>& a, ScalarTy b)
 {
-    return Vector<Ty>(a.getX()/b, a.getY()/b);
+    return Vector<Ty,Dims>(a.getX()/b, a.getY()/b, a.getZ()/b);
 }
 
 Acceleration operator / (const Force& a, units::mass::kilogram_t b)
 {
-    return Acceleration(a.getX()/b, a.getY()/b);
+    return Acceleration(a.getX()/b, a.getY()/b, a.getZ()/b);
 }
 
-//create a force in the direction of a given x/y coordinate, with vector length equal to strength
+//create a force in the direction of a given x/y(/z) coordinate, with vector length equal to strength
 //   See: http://www.leadinglesson.com/problem-on-finding-a-vector-with-given-length-and-direction
 template<class DirTy>
-Force createForceInDirection(DirTy x, DirTy y, Force::UnitTy strength)
+Force createForceInDirection(DirTy x, DirTy y, DirTy z, Force::UnitTy strength)
 {
-  DirTy distance = units::math::hypot(x,y);
+  DirTy distance = units::math::hypot(units::math::hypot(x,y),z);
   ScalarTy unitX = x / distance;
   ScalarTy unitY = y / distance;
-  return Force(unitX * strength, unitY * strength);
+  ScalarTy unitZ = z / distance;
+  return Force(unitX * strength, unitY * strength, unitZ * strength);
+}
+
+template<class DirTy>
+Force createForceInDirection(DirTy x, DirTy y, Force::UnitTy strength)
+{
+  return createForceInDirection(x, y, DirTy(0.0), strength);
+}
+
+//the length of a vector of Dims components, of double or Fixed; hypot(d, 0)
+//    is exactly |d|, so a 3D length in the plane matches the 2D one
+template<unsigned Dims, class ValueTy>
+inline ValueTy vectorLength(const ValueTy* v)
+{
+    using std::hypot;
+    return Dims > 2 ? hypot(hypot(v[0], v[1]), v[Dims-1]) : hypot(v[0], v[1]);
 }
 
 class PositionableObject;
+template<unsigned Dims> class BasicPhysicsWorld;
+typedef BasicPhysicsWorld<EVOL_DIMENSIONS> PhysicsWorld;
 
 typedef std::shared_ptr<PositionableObject> PositionableObjectPtr;
 
+//the state of every node in a PhysicsWorld, one array per component so that
+//    passes over all nodes stream through memory (and vectorize); values are
+//    in SI units.  pos[0] is x, pos[1] is y (up) and pos[2] is z; a world
+//    with fewer dimensions never changes the components it doesn't use
+struct NodeArrays {
+    std::vector<double> pos[MAX_DIMENSIONS], vel[MAX_DIMENSIONS], mass;
+//the total force on each node this tick
+    std::vector<double> force[MAX_DIMENSIONS];
+//1 where the node is touching the ground, 0 elsewhere
+    std::vector<unsigned char> contact;
+    size_t size() const {return mass.size();}
+};
+
 //this class represents a source of force
 class ForceSource {
 public:
+    virtual ~ForceSource() {}
     virtual Force getForce(PositionableObject*)=0;
 };
 
@@ -75,43 +119,84 @@ typedef std::shared_ptr<ForceSource> ForceSourcePtr;
 //this class represents something that exists in space
 //     and can have forces applied to it
 class PositionableObject {
+//the world keeps our state in its arrays while we are in it
+    template<unsigned Dims> friend class BasicPhysicsWorld;
 public:
     typedef units::length::meter_t PositTy;
     typedef units::velocity::meters_per_second_t VelocityTy;
     typedef units::mass::pound_t MassTy;
 private:
-    PositTy posx, posy;
-    VelocityTy vx, vy;
+    PositTy posx, posy, posz;
+    VelocityTy vx, vy, vz;
     std::vector<ForceSourcePtr> forceSources;
-protected:
-    virtual MassTy getMass()=0;
+//while in a world, our state lives in its arrays rather than in the members above
+    NodeArrays* boundArrays;
+    size_t boundIndex;
 public:
-    PositionableObject(PositTy x, PositTy y) : posx(x), posy(y), vx(0.0), vy(0.0) {}
-    PositTy getPosX(){return posx;}
-    PositTy getPosY(){return posy;}
+    virtual MassTy getMass()=0;
+//change our mass, for the kinds of object whose mass is not fixed; false if
+//    ours is.  Like our other state, taken by a world when we are added to it
+    virtual bool setMass(MassTy) {return false;}
+    PositionableObject(PositTy x, PositTy y, PositTy z = PositTy(0.0)) :
+        posx(x), posy(y), posz(z), vx(0.0), vy(0.0), vz(0.0), boundArrays(nullptr), boundIndex(0) {}
+//copies take the position and velocity but not the force sources; those
+//    belong to whatever the original was connected to
+    PositionableObject(const PositionableObject& other) :
+        posx(other.getPosX()), posy(other.getPosY()), posz(other.getPosZ()),
+        vx(other.getVelX()), vy(other.getVelY()), vz(other.getVelZ()), boundArrays(nullptr), boundIndex(0) {}
+    virtual ~PositionableObject() {}
+    virtual PositionableObjectPtr clone()=0;
+    PositTy getPosX() const {return boundArrays ? PositTy(boundArrays->pos[0][boundIndex]) : posx;}
+    PositTy getPosY() const {return boundArrays ? PositTy(boundArrays->pos[1][boundIndex]) : posy;}
+    PositTy getPosZ() const {return boundArrays ? PositTy(boundArrays->pos[2][boundIndex]) : posz;}
+    VelocityTy getVelX() const {return boundArrays ? VelocityTy(boundArrays->vel[0][boundIndex]) : vx;}
+    VelocityTy getVelY() const {return boundArrays ? VelocityTy(boundArrays->vel[1][boundIndex]) : vy;}
+    VelocityTy getVelZ() const {return boundArrays ? VelocityTy(boundArrays->vel[2][boundIndex]) : vz;}
+//where we are in the world's arrays, if we are in one
+    bool isInWorld() const {return boundArrays != nullptr;}
+    size_t getWorldIndex() const {return boundIndex;}
     void addForceSource(ForceSourcePtr fs) {forceSources.push_back(fs);}
-    void update()
+    void removeForceSource(ForceSource* fs)
+    {
+        for(auto FI = forceSources.begin(); FI != forceSources.end(); )
+        {
+            if( FI->get() == fs ) FI = forceSources.erase(FI);
+            else ++FI;
+        }
+    }
+    bool hasForceSources() const {return !forceSources.empty();}
+//sum forces acting on us
+    Force getTotalForce()
     {
-        //sum forces acting on us
         Force total;
         for( auto fsource : forceSources )
         {
             total = total + fsource->getForce(this);
         }
+        return total;
+    }
+//move forward one tick on our own; objects in a world are moved by the world
+    void update()
+    {
+        if( isInWorld() ) return;
+        Force total = getTotalForce();
         //calculate acceleration, F=M*A
         Acceleration accel = total / getMass();
         //calculate velocity, dV = A*t
         vx += accel.getX() * TIME_RATE;
         vy += accel.getY() * TIME_RATE;
+        vz += accel.getZ() * TIME_RATE;
         //calculate position, dP = V*t
         posx += vx * TIME_RATE;
         posy += vy * TIME_RATE;
+        posz += vz * TIME_RATE;
     }
 };
 
 PositionableObject::PositTy getDistance(PositionableObjectPtr objectA, PositionableObjectPtr objectB)
 {
-    return units::math::hypot(objectA->getPosX() - objectB->getPosX(), objectA->getPosY() - objectB->getPosY()); 
+    return units::math::hypot(units::math::hypot(objectA->getPosX() - objectB->getPosX(), objectA->getPosY() - objectB->getPosY()),
+                              objectA->getPosZ() - objectB->getPosZ());
 }
 
 }; //namespace EVOL_NS
@@ -0,0 +1,130 @@
+#ifndef _FORCE_FIELDS_H__
+#define _FORCE_FIELDS_H__
+
+#include "config.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "Force.h"
+
+//drag coefficients aren't first class types either
+namespace units {
+UNIT_ADD(linear_drag, kilogram_per_second, kilograms_per_second, kgps, compound_unit<mass::kilogram, inverse<time::seconds>>)
+UNIT_ADD(quadratic_drag, kilogram_per_meter, kilograms_per_meter, kgpm, compound_unit<mass::kilogram, inverse<length::meter>>)
+};
+
+namespace EVOL_NS {
+
+//the velocity of the air (or water) over a rectangle of the world, given at
+//    the points of a regular grid and interpolated in between; positions off
+//    the grid see the flow at its nearest edge
+class FlowGrid {
+    size_t columns, rows;
+    double originX, originY, spacing;
+    std::vector<double> flowX, flowY;
+    FlowGrid(size_t cols, size_t rws, double x0, double y0, double space) :
+        columns(cols), rows(rws), originX(x0), originY(y0), spacing(space), flowX(cols * rws, 0.0), flowY(cols * rws, 0.0) {}
+public:
+//a grid of cols by rws points, all with no flow, where point (col,row) is at
+//    origin + spacing * (col,row); null unless there is at least one point
+//    and the spacing is positive
+    static std::shared_ptr<FlowGrid> make(size_t cols, size_t rws, PositionableObject::PositTy x0,
+                                          PositionableObject::PositTy y0, PositionableObject::PositTy space)
+    {
+        if( cols == 0 or rws == 0 or !(space() > 0) ) return std::shared_ptr<FlowGrid>();
+        return std::shared_ptr<FlowGrid>(new FlowGrid(cols, rws, x0(), y0(), space()));
+    }
+    void setFlow(size_t col, size_t row, PositionableObject::VelocityTy vx, PositionableObject::VelocityTy vy)
+    {
+        flowX[row * columns + col] = vx();
+        flowY[row * columns + col] = vy();
+    }
+//bilinear interpolation of the flow at (x,y), in meters and meters/second
+    void sample(double x, double y, double& vx, double& vy) const
+    {
+        double gx = (x - originX) / spacing;
+        double gy = (y - originY) / spacing;
+        gx = gx < 0 ? 0 : (gx > columns - 1 ? columns - 1 : gx);
+        gy = gy < 0 ? 0 : (gy > rows - 1 ? rows - 1 : gy);
+        size_t col = std::min<size_t>(gx, columns > 1 ? columns - 2 : 0);
+        size_t row = std::min<size_t>(gy, rows > 1 ? rows - 2 : 0);
+        size_t nextCol = columns > 1 ? col + 1 : col;
+        size_t nextRow = rows > 1 ? row + 1 : row;
+        double tx = gx - col, ty = gy - row;
+        size_t c00 = row * columns + col, c10 = row * columns + nextCol;
+        size_t c01 = nextRow * columns + col, c11 = nextRow * columns + nextCol;
+        vx = (flowX[c00] * (1 - tx) + flowX[c10] * tx) * (1 - ty) + (flowX[c01] * (1 - tx) + flowX[c11] * tx) * ty;
+        vy = (flowY[c00] * (1 - tx) + flowY[c10] * tx) * (1 - ty) + (flowY[c01] * (1 - tx) + flowY[c11] * tx) * ty;
+    }
+};
+
+typedef std::shared_ptr<const FlowGrid> FlowGridPtr;
+
+//forces from the environment that act on every node of a world: uniform
+//    gravity, and drag against the surrounding air (a uniform wind plus an
+//    optional flow grid).  All of them are applied in a single pass over the
+//    node arrays, rather than as a ForceSource on every node
+class ForceFields {
+    double gravity[MAX_DIMENSIONS];
+    double linearDrag, quadraticDrag;
+    double wind[MAX_DIMENSIONS];
+//read only, so one grid can be shared by every world evaluating a population
+    FlowGridPtr flow;
+public:
+    ForceFields() : gravity{0.0, 0.0, 0.0}, linearDrag(0.0), quadraticDrag(0.0), wind{0.0, 0.0, 0.0} {}
+    void setGravity(Acceleration g) {for(unsigned d = 0; d < MAX_DIMENSIONS; ++d) gravity[d] = g.get(d)();}
+//drag force is -(linear + quadratic * speed) times the velocity relative to the air
+    void setLinearDrag(units::linear_drag::kilogram_per_second_t drag) {linearDrag = drag();}
+    void setQuadraticDrag(units::quadratic_drag::kilogram_per_meter_t drag) {quadraticDrag = drag();}
+    void setWind(PositionableObject::VelocityTy vx, PositionableObject::VelocityTy vy,
+                 PositionableObject::VelocityTy vz = PositionableObject::VelocityTy(0.0))
+    {
+        wind[0] = vx();
+        wind[1] = vy();
+        wind[2] = vz();
+    }
+//the grid gives the flow in x and y only
+    void setFlowGrid(FlowGridPtr grid) {flow = grid;}
+    bool isEmpty() const {return gravity[0] == 0 and gravity[1] == 0 and gravity[2] == 0 and linearDrag == 0 and quadraticDrag == 0;}
+//add the field forces onto the force of every node in a world of Dims dimensions
+    template<unsigned Dims>
+    void apply(NodeArrays& n) const
+    {
+        size_t count = n.size();
+        for(unsigned d = 0; d < Dims; ++d)
+        {
+            if( gravity[d] == 0 ) continue;
+            double* force = n.force[d].data();
+            const double* mass = n.mass.data();
+            for(size_t i = 0; i < count; ++i)
+                force[i] += mass[i] * gravity[d];
+        }
+        if( linearDrag == 0 and quadraticDrag == 0 ) return;
+        for(size_t i = 0; i < count; ++i)
+        {
+            double air[MAX_DIMENSIONS] = {wind[0], wind[1], wind[2]};
+            if( flow )
+            {
+                double flowX, flowY;
+                flow->sample(n.pos[0][i], n.pos[1][i], flowX, flowY);
+                air[0] += flowX;
+                air[1] += flowY;
+            }
+            double relative[Dims], speedSquared = 0.0;
+            for(unsigned d = 0; d < Dims; ++d)
+            {
+                relative[d] = n.vel[d][i] - air[d];
+                speedSquared += relative[d] * relative[d];
+            }
+            double coefficient = linearDrag + quadraticDrag * std::sqrt(speedSquared);
+            for(unsigned d = 0; d < Dims; ++d)
+                n.force[d][i] -= coefficient * relative[d];
+        }
+    }
+};
+
+}; //namespace EVOL_NS
+
+#endif
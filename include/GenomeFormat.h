@@ -0,0 +1,410 @@
+#ifndef _GENOME_FORMAT_H__
+#define _GENOME_FORMAT_H__
+
+#include "config.h"
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include "AxonTypes.h"
+#include "Bone.h"
+#include "Creature.h"
+#include "Force.h"
+#include "Muscle.h"
+#include "SensorAxons.h"
+
+namespace EVOL_NS {
+
+//the node a decoded creature is built from: a point with a mass and nothing
+//    else, which is all the physics ever asks of a node
+class PointMass : public PositionableObject {
+    MassTy mass;
+public:
+    PointMass(PositTy x, PositTy y, PositTy z, MassTy m) : PositionableObject(x, y, z), mass(m) {}
+    virtual MassTy getMass() {return mass;}
+    virtual bool setMass(MassTy m) {mass = m; return true;}
+    virtual PositionableObjectPtr clone() {return PositionableObjectPtr(new PointMass(*this));}
+};
+
+//a creature as bytes, for sending between processes or writing to disk.
+//    Everything is little endian, whatever the machine:
+//      "EVG1"
+//      u32 node count, then per node (in name order):
+//          string name, f64 mass (kg), f64 x, y, z (m)
+//      u32 part count, then per part (in name order):
+//          string name, u8 kind, the kind's values, u32 input count, u32 input
+//          part numbers (in this same order)
+//    with strings as a u32 length and that many bytes, and node or part
+//    numbers NONE (0xffffffff) for nothing.  The kinds and their values:
+//      CONST  f32 value
+//      TIME, ADD, SUB  nothing
+//      MUSCLE  f64 rigidity (N/m), f64 rest length (m), u8 activation
+//              function, f32 min scale, max scale, gain, u32 node A, node B
+//      BONE    f64 length (m), u32 node A, node B
+//      SENSOR  u8 quantity, u32 muscle part, u32 node A, node B
+//    Creatures are stored as they are before being simulated: velocities,
+//    axon outputs and the like are not kept, and nodes come back as PointMass
+class GenomeFormat {
+public:
+    enum KindTy {CONST, TIME, ADD, SUB, MUSCLE, BONE, SENSOR};
+    static const uint32_t NONE = uint32_t(-1);
+private:
+    class Writer {
+        std::vector<uint8_t>& out;
+    public:
+        Writer(std::vector<uint8_t>& o) : out(o) {}
+        void u8(uint8_t v) {out.push_back(v);}
+        void u32(uint32_t v)
+        {
+            for(int b = 0; b < 4; ++b)
+                out.push_back(uint8_t(v >> (8 * b)));
+        }
+        void u64(uint64_t v)
+        {
+            for(int b = 0; b < 8; ++b)
+                out.push_back(uint8_t(v >> (8 * b)));
+        }
+        void f32(float v)
+        {
+            uint32_t bits;
+            std::memcpy(&bits, &v, sizeof(bits));
+            u32(bits);
+        }
+        void f64(double v)
+        {
+            uint64_t bits;
+            std::memcpy(&bits, &v, sizeof(bits));
+            u64(bits);
+        }
+        void string(const std::string& s)
+        {
+            u32(s.size());
+            out.insert(out.end(), s.begin(), s.end());
+        }
+    };
+//reads past the end give 0 and leave ok false from then on
+    class Reader {
+        const uint8_t* data;
+        size_t size, pos;
+    public:
+        bool ok;
+        Reader(const uint8_t* d, size_t s) : data(d), size(s), pos(0), ok(true) {}
+        bool atEnd() const {return pos == size;}
+//a count of things at least each bytes long each, which there must be room for
+        uint32_t count(size_t each)
+        {
+            uint32_t n = u32();
+            if( n > (size - pos) / each ) ok = false;
+            return ok ? n : 0;
+        }
+        uint64_t bytes(int count)
+        {
+            if( size - pos < size_t(count) ) ok = false;
+            if( !ok ) return 0;
+            uint64_t v = 0;
+            for(int b = 0; b < count; ++b)
+                v |= uint64_t(data[pos++]) << (8 * b);
+            return v;
+        }
+        uint8_t u8() {return bytes(1);}
+        uint32_t u32() {return bytes(4);}
+        float f32()
+        {
+            uint32_t bits = bytes(4);
+            float v;
+            std::memcpy(&v, &bits, sizeof(v));
+            return v;
+        }
+        double f64()
+        {
+            uint64_t bits = bytes(8);
+            double v;
+            std::memcpy(&v, &bits, sizeof(v));
+            return v;
+        }
+        std::string string()
+        {
+            uint32_t length = u32();
+            if( size - pos < length ) ok = false;
+            if( !ok ) return std::string();
+            std::string s((const char*)data + pos, length);
+            pos += length;
+            return s;
+        }
+    };
+//a part as read, before any of them are built
+    struct PartRecord {
+        std::string name;
+        uint8_t kind;
+        float value, minScale, maxScale, gain;
+        double rigidity, length;
+        uint8_t function;
+        uint32_t muscle, nodeA, nodeB;
+        std::vector<uint32_t> inputs;
+    };
+public:
+//append creature to out; false (with out left as it was) if it has a part
+//    of a kind not listed above, an input from outside the creature, a
+//    muscle or bone that is not between two of its nodes, or anything else
+//    decode() would turn away
+    static bool encode(const Creature& creature, std::vector<uint8_t>& out)
+    {
+        std::map<const void*,uint32_t> nodeNumbers, partNumbers;
+        std::vector<std::string> nodeNames;
+        for(auto NI = creature.nodeBegin(); NI != creature.nodeEnd(); ++NI)
+        {
+            nodeNumbers[NI->second.get()] = nodeNames.size();
+            nodeNames.push_back(NI->first);
+        }
+        uint32_t count = 0;
+        for(auto BI = creature.begin(); BI != creature.end(); ++BI, ++count)
+        {
+            partNumbers[BI->second.get()] = count;
+            if( Axon* axe = dynamic_cast<Axon*>(BI->second.get()) )
+                partNumbers[axe] = count;
+        }
+        auto nodeNumber = [&](const PositionableObjectPtr& node) {
+            auto result = nodeNumbers.find(node.get());
+            return result == nodeNumbers.end() ? uint32_t(NONE) : result->second;
+        };
+        size_t start = out.size();
+        Writer w(out);
+        w.u8('E'); w.u8('V'); w.u8('G'); w.u8('1');
+        w.u32(nodeNames.size());
+        for(auto NI = creature.nodeBegin(); NI != creature.nodeEnd(); ++NI)
+        {
+            w.string(NI->first);
+            w.f64(units::mass::kilogram_t(NI->second->getMass())());
+            w.f64(NI->second->getPosX()());
+            w.f64(NI->second->getPosY()());
+            w.f64(NI->second->getPosZ()());
+        }
+        w.u32(count);
+        for(auto BI = creature.begin(); BI != creature.end(); ++BI)
+        {
+            BodyPart* part = BI->second.get();
+            w.string(BI->first);
+            if( ConstAxon* c = dynamic_cast<ConstAxon*>(part) )
+            {
+                w.u8(CONST);
+                w.f32(c->getConstValue());
+            }
+            else if( dynamic_cast<TimeAxon*>(part) ) w.u8(TIME);
+            else if( dynamic_cast<AddAxon*>(part) ) w.u8(ADD);
+            else if( dynamic_cast<SubAxon*>(part) ) w.u8(SUB);
+            else if( Muscle* m = dynamic_cast<Muscle*>(part) )
+            {
+                const MuscleActivation& act = m->getActivation();
+                w.u8(MUSCLE);
+                w.f64(m->getRigidity()());
+                w.f64(m->getRestLength()());
+                w.u8(act.function);
+                w.f32(act.minScale);
+                w.f32(act.maxScale);
+                w.f32(act.gain);
+                w.u32(nodeNumber(m->getEndA()));
+                w.u32(nodeNumber(m->getEndB()));
+                if( nodeNumber(m->getEndA()) == NONE or nodeNumber(m->getEndB()) == NONE )
+                {
+                    out.resize(start);
+                    return false;
+                }
+            }
+            else if( Bone* bone = dynamic_cast<Bone*>(part) )
+            {
+                w.u8(BONE);
+                w.f64(bone->getLength()());
+                w.u32(nodeNumber(bone->getEndA()));
+                w.u32(nodeNumber(bone->getEndB()));
+                if( nodeNumber(bone->getEndA()) == NONE or nodeNumber(bone->getEndB()) == NONE )
+                {
+                    out.resize(start);
+                    return false;
+                }
+            }
+            else if( SensorAxon* sensor = dynamic_cast<SensorAxon*>(part) )
+            {
+                w.u8(SENSOR);
+                w.u8(sensor->getQuantity());
+                MusclePtr m = sensor->getMuscle();
+                auto muscle = partNumbers.find(static_cast<BodyPart*>(m.get()));
+                bool ofMuscle = sensor->getQuantity() == SensorAxon::MUSCLE_LENGTH or sensor->getQuantity() == SensorAxon::MUSCLE_STRAIN;
+                if( (m and muscle == partNumbers.end()) or ofMuscle != bool(m) )
+                {
+                    out.resize(start);
+                    return false;
+                }
+                w.u32(m ? muscle->second : uint32_t(NONE));
+                w.u32(m ? NONE : nodeNumber(sensor->getNodeA()));
+                w.u32(m ? NONE : nodeNumber(sensor->getNodeB()));
+            }
+            else
+            {
+                out.resize(start);
+                return false;
+            }
+            std::vector<uint32_t> inputs;
+            if( CanHaveAxonInputs* base = dynamic_cast<CanHaveAxonInputs*>(part) )
+                for(auto II = base->inputBegin(); II != base->inputEnd(); ++II)
+                {
+                    auto result = partNumbers.find(II->get());
+                    if( result == partNumbers.end() )
+                    {
+                        out.resize(start);
+                        return false;
+                    }
+                    inputs.push_back(result->second);
+                }
+            w.u32(inputs.size());
+            for(uint32_t in : inputs)
+                w.u32(in);
+        }
+        return true;
+    }
+    static std::vector<uint8_t> encode(const Creature& creature)
+    {
+        std::vector<uint8_t> out;
+        encode(creature, out);
+        return out;
+    }
+//the creature in size bytes of data, into out; false if they are not
+//    exactly one well formed creature, in which case out is left as it was.
+//    Anything that could not be simulated is turned away here, since this
+//    is all that stands between bytes from elsewhere and the evaluator: a
+//    muscle or bone without both ends, or a sensor whose quantity is of a
+//    muscle but has none (or the other way round)
+    static bool decode(const uint8_t* data, size_t size, Creature& out)
+    {
+        Reader r(data, size);
+        if( r.u8() != 'E' or r.u8() != 'V' or r.u8() != 'G' or r.u8() != '1' ) return false;
+        Creature creature;
+        std::vector<std::string> nodeNames(r.count(36));
+        std::vector<PositionableObjectPtr> nodes;
+        for(size_t n = 0; n < nodeNames.size() and r.ok; ++n)
+        {
+            nodeNames[n] = r.string();
+            if( n > 0 and !(nodeNames[n - 1] < nodeNames[n]) ) return false;
+            double mass = r.f64(), x = r.f64(), y = r.f64(), z = r.f64();
+            nodes.push_back(PositionableObjectPtr(new PointMass(PositionableObject::PositTy(x), PositionableObject::PositTy(y),
+                                                                PositionableObject::PositTy(z), units::mass::kilogram_t(mass))));
+            creature.addNode(nodeNames[n], nodes.back());
+        }
+        std::vector<PartRecord> records(r.count(9));
+        for(size_t i = 0; i < records.size() and r.ok; ++i)
+        {
+            PartRecord& p = records[i];
+            p.name = r.string();
+            if( i > 0 and !(records[i - 1].name < p.name) ) return false;
+            p.kind = r.u8();
+            p.muscle = p.nodeA = p.nodeB = NONE;
+            switch( p.kind )
+            {
+            case CONST: p.value = r.f32(); break;
+            case TIME: case ADD: case SUB: break;
+            case MUSCLE:
+                p.rigidity = r.f64();
+                p.length = r.f64();
+                p.function = r.u8();
+                p.minScale = r.f32();
+                p.maxScale = r.f32();
+                p.gain = r.f32();
+                p.nodeA = r.u32();
+                p.nodeB = r.u32();
+                if( p.function >= MuscleActivation::FUNCTION_COUNT ) return false;
+                break;
+            case BONE:
+                p.length = r.f64();
+                p.nodeA = r.u32();
+                p.nodeB = r.u32();
+                break;
+            case SENSOR:
+                p.function = r.u8();
+                p.muscle = r.u32();
+                p.nodeA = r.u32();
+                p.nodeB = r.u32();
+                if( p.function >= SensorAxon::QUANTITY_COUNT ) return false;
+                break;
+            default: return false;
+            }
+            p.inputs.resize(r.count(4));
+            for(auto& in : p.inputs)
+                in = r.u32();
+        }
+        if( !r.ok or !r.atEnd() ) return false;
+        auto node = [&](uint32_t n) {return n < nodes.size() ? nodes[n] : PositionableObjectPtr();};
+        auto bothEnds = [&](const PartRecord& p) {return node(p.nodeA) and node(p.nodeB);};
+        //sensors of muscles need the muscle built first
+        std::vector<BodyPartPtr> parts(records.size());
+        for(size_t i = 0; i < records.size(); ++i)
+        {
+            const PartRecord& p = records[i];
+            switch( p.kind )
+            {
+            case CONST: parts[i].reset(new ConstAxon(p.value)); break;
+            case TIME: parts[i].reset(new TimeAxon()); break;
+            case ADD: parts[i].reset(new AddAxon()); break;
+            case SUB: parts[i].reset(new SubAxon()); break;
+            case MUSCLE:
+            {
+                if( !bothEnds(p) ) return false;
+                MuscleActivation act(MuscleActivation::FunctionTy(p.function), p.minScale, p.maxScale, p.gain);
+                MusclePtr m(new Muscle(Muscle::RigidityTy(p.rigidity), Muscle::LengthTy(p.length), act));
+                m->connectEnds(nodes[p.nodeA], nodes[p.nodeB]);
+                parts[i] = m;
+                break;
+            }
+            case BONE:
+            {
+                if( !bothEnds(p) ) return false;
+                BonePtr bone(new Bone(Bone::LengthTy(p.length)));
+                bone->connectEnds(nodes[p.nodeA], nodes[p.nodeB]);
+                parts[i] = bone;
+                break;
+            }
+            }
+        }
+        for(size_t i = 0; i < records.size(); ++i)
+        {
+            const PartRecord& p = records[i];
+            if( p.kind != SENSOR ) continue;
+            SensorAxon::QuantityTy q = SensorAxon::QuantityTy(p.function);
+            bool ofMuscle = q == SensorAxon::MUSCLE_LENGTH or q == SensorAxon::MUSCLE_STRAIN;
+            if( ofMuscle != (p.muscle != NONE) ) return false;
+            if( ofMuscle )
+            {
+                MusclePtr m = p.muscle < parts.size() ? std::dynamic_pointer_cast<Muscle>(parts[p.muscle]) : MusclePtr();
+                if( !m ) return false;
+                parts[i].reset(new SensorAxon(q, m));
+            }
+            else if( q == SensorAxon::ORIENTATION )
+            {
+                if( !node(p.nodeA) or !node(p.nodeB) ) return false;
+                parts[i].reset(new SensorAxon(nodes[p.nodeA], nodes[p.nodeB]));
+            }
+            else
+            {
+                if( !node(p.nodeA) ) return false;
+                parts[i].reset(new SensorAxon(q, nodes[p.nodeA]));
+            }
+        }
+        for(size_t i = 0; i < records.size(); ++i)
+        {
+            creature.add(records[i].name, parts[i]);
+            for(uint32_t in : records[i].inputs)
+            {
+                CanHaveAxonInputs* base = dynamic_cast<CanHaveAxonInputs*>(parts[i].get());
+                AxonPtr axe = in < parts.size() ? std::dynamic_pointer_cast<Axon>(parts[in]) : AxonPtr();
+                if( !base or !axe ) return false;
+                base->addAxonAsInput(axe);
+            }
+        }
+        out = creature;
+        return true;
+    }
+    static bool decode(const std::vector<uint8_t>& data, Creature& out) {return decode(data.data(), data.size(), out);}
+};
+
+}; //namespace EVOL_NS
+
+#endif
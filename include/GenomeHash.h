@@ -0,0 +1,183 @@
+#ifndef _GENOME_HASH_H__
+#define _GENOME_HASH_H__
+
+#include "config.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+#include "AxonTypes.h"
+#include "Bone.h"
+#include "Creature.h"
+#include "Muscle.h"
+#include "SensorAxons.h"
+
+namespace EVOL_NS {
+
+//builds a 64 bit hash out of a sequence of values
+class Hasher {
+    uint64_t h;
+//splitmix64's finalizer
+    static uint64_t mix(uint64_t x)
+    {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+public:
+    Hasher(uint64_t seed = 0) : h(mix(seed + 0x9e3779b97f4a7c15ULL)) {}
+    Hasher& add(uint64_t v) {h = mix(h ^ mix(v + 0x9e3779b97f4a7c15ULL)); return *this;}
+//-0 hashes as 0, and every NaN the same
+    Hasher& add(double v)
+    {
+        if( v == 0.0 ) v = 0.0;
+        if( v != v ) v = std::numeric_limits<double>::quiet_NaN();
+        uint64_t bits;
+        std::memcpy(&bits, &v, sizeof(bits));
+        return add(bits);
+    }
+    Hasher& add(const std::string& s)
+    {
+        add(uint64_t(s.size()));
+        for(char c : s)
+            add(uint64_t((unsigned char)c));
+        return *this;
+    }
+    uint64_t get() const {return h;}
+};
+
+//a hash of everything about a creature that decides how it behaves: its
+//    nodes (mass, position and velocity), its parts (type and
+//    parameters) and how they are connected, but not what anything is named
+//    or the order the maps keep them in.  Two creatures that differ only in
+//    names hash the same.
+//    Each node and part starts with a hash of its own values, and is then
+//    rehashed with the hashes of its neighbours, round after round, until a
+//    round tells no more of them apart (Weisfeiler-Lehman refinement); the
+//    creature's hash is that of the sorted final hashes.  Parts of kinds not
+//    known here contribute only their type and connections
+inline uint64_t genomeHash(const Creature& creature)
+{
+    //a connection from one element to another; elements are the nodes,
+    //    then the parts, then one for anything outside the creature
+    enum RoleTy {END_A, END_B, SENSOR_A, SENSOR_B, SENSOR_MUSCLE, INPUT};
+    struct Link {
+        uint64_t role;
+        size_t to;
+    };
+    std::map<const void*,size_t> index;
+    std::vector<uint64_t> label;
+    for(auto NI = creature.nodeBegin(); NI != creature.nodeEnd(); ++NI)
+    {
+        PositionableObject& node = *NI->second;
+        index[&node] = label.size();
+        label.push_back(Hasher(1).add(units::mass::kilogram_t(node.getMass())())
+            .add(node.getPosX()()).add(node.getPosY()()).add(node.getPosZ()())
+            .add(node.getVelX()()).add(node.getVelY()()).add(node.getVelZ()()).get());
+    }
+    for(auto BI = creature.begin(); BI != creature.end(); ++BI)
+    {
+        index[BI->second.get()] = label.size();
+        if( Axon* axe = dynamic_cast<Axon*>(BI->second.get()) )
+            index[axe] = label.size();
+        label.push_back(0);
+    }
+    size_t outside = label.size();
+    label.push_back(Hasher(3).get());
+    auto find = [&](const void* p) {
+        auto result = index.find(p);
+        return result == index.end() ? outside : result->second;
+    };
+    std::vector<std::vector<Link>> links(label.size());
+    for(auto BI = creature.begin(); BI != creature.end(); ++BI)
+    {
+        BodyPart* part = BI->second.get();
+        size_t self = index[part];
+        Hasher h(2);
+        h.add(part->getTypeAsString());
+        if( Axon* axe = dynamic_cast<Axon*>(part) )
+            h.add(double(axe->getOutputValue()));
+        if( ConstAxon* c = dynamic_cast<ConstAxon*>(part) )
+            h.add(double(c->getConstValue()));
+        if( Muscle* m = dynamic_cast<Muscle*>(part) )
+        {
+            const MuscleActivation& act = m->getActivation();
+            h.add(m->getRigidity()()).add(m->getRestLength()()).add(m->getDesiredLength()())
+             .add(uint64_t(act.function)).add(double(act.minScale)).add(double(act.maxScale)).add(double(act.gain));
+            links[self].push_back(Link{END_A, find(m->getEndA().get())});
+            links[self].push_back(Link{END_B, find(m->getEndB().get())});
+        }
+        if( Bone* bone = dynamic_cast<Bone*>(part) )
+        {
+            h.add(bone->getLength()());
+            links[self].push_back(Link{END_A, find(bone->getEndA().get())});
+            links[self].push_back(Link{END_B, find(bone->getEndB().get())});
+        }
+        if( SensorAxon* sensor = dynamic_cast<SensorAxon*>(part) )
+        {
+            h.add(uint64_t(sensor->getQuantity()));
+            if( MusclePtr m = sensor->getMuscle() )
+                links[self].push_back(Link{SENSOR_MUSCLE, find(static_cast<BodyPart*>(m.get()))});
+            else
+            {
+                links[self].push_back(Link{SENSOR_A, find(sensor->getNodeA().get())});
+                links[self].push_back(Link{SENSOR_B, find(sensor->getNodeB().get())});
+            }
+        }
+        //inputs are in order, since some parts (SubAxon, FIRST_INPUT
+        //    muscles) care about it
+        if( CanHaveAxonInputs* base = dynamic_cast<CanHaveAxonInputs*>(part) )
+        {
+            uint64_t position = 0;
+            for(auto II = base->inputBegin(); II != base->inputEnd(); ++II)
+                links[self].push_back(Link{INPUT + position++, find(II->get())});
+        }
+        label[self] = h.get();
+    }
+    std::vector<std::vector<Link>> linkedFrom(label.size());
+    for(size_t e = 0; e < links.size(); ++e)
+        for(const Link& l : links[e])
+            linkedFrom[l.to].push_back(Link{l.role, e});
+    auto distinct = [](std::vector<uint64_t> labels) {
+        std::sort(labels.begin(), labels.end());
+        return size_t(std::unique(labels.begin(), labels.end()) - labels.begin());
+    };
+    size_t classes = distinct(label);
+    std::vector<uint64_t> next(label.size()), from;
+    for(size_t round = 0; round < label.size(); ++round)
+    {
+        for(size_t e = 0; e < label.size(); ++e)
+        {
+            Hasher h(label[e]);
+            for(const Link& l : links[e])
+                h.add(l.role).add(label[l.to]);
+            from.clear();
+            for(const Link& l : linkedFrom[e])
+                from.push_back(Hasher(l.role).add(label[l.to]).get());
+            std::sort(from.begin(), from.end());
+            h.add(uint64_t(from.size()));
+            for(uint64_t f : from)
+                h.add(f);
+            next[e] = h.get();
+        }
+        label.swap(next);
+        size_t refined = distinct(label);
+        if( refined == classes ) break;
+        classes = refined;
+    }
+    std::sort(label.begin(), label.end());
+    Hasher h(4);
+    h.add(uint64_t(label.size()));
+    for(uint64_t l : label)
+        h.add(l);
+    return h.get();
+}
+
+}; //namespace EVOL_NS
+
+#endif
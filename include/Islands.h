@@ -0,0 +1,332 @@
+#ifndef _ISLANDS_H__
+#define _ISLANDS_H__
+
+#include "config.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "Creature.h"
+#include "GenomeFormat.h"
+#include "SteadyState.h"
+
+namespace EVOL_NS {
+
+//which islands send their migrants to which
+struct MigrationTopology {
+    std::vector<std::vector<unsigned>> targets;
+    MigrationTopology(unsigned islands = 0) : targets(islands) {}
+    unsigned getIslandCount() const {return targets.size();}
+    void connect(unsigned from, unsigned to) {targets[from].push_back(to);}
+//each island sends to the next, the last to the first
+    static MigrationTopology ring(unsigned islands)
+    {
+        MigrationTopology t(islands);
+        for(unsigned i = 0; islands > 1 and i < islands; ++i)
+            t.connect(i, (i + 1) % islands);
+        return t;
+    }
+//each island sends to the islands on either side of it
+    static MigrationTopology bidirectionalRing(unsigned islands)
+    {
+        MigrationTopology t = ring(islands);
+        for(unsigned i = 0; islands > 2 and i < islands; ++i)
+            t.connect(i, (i + islands - 1) % islands);
+        return t;
+    }
+//each island sends to every other
+    static MigrationTopology complete(unsigned islands)
+    {
+        MigrationTopology t(islands);
+        for(unsigned i = 0; i < islands; ++i)
+            for(unsigned j = 0; j < islands; ++j)
+                if( i != j ) t.connect(i, j);
+        return t;
+    }
+};
+
+//one inbox per island in a named POSIX shared memory object, which any
+//    process on the host can open.  Each inbox is a bounded ring of fixed
+//    size slots that any number of processes can send to and receive from
+//    at once without locks (Vyukov's bounded queue): a slot's sequence number
+//    says whether it is free for the sender whose turn it is or full for the
+//    receiver whose turn it is.  The atomics are lock free, so they work
+//    between processes as well as between threads.  A message that does not
+//    fit in a slot, or that arrives at a full inbox, is turned away
+class MigrationChannel {
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "shared memory queues need lock free 64 bit atomics");
+    static const uint64_t MAGIC = 0x45564f4c4d494731ULL; //"EVOLMIG1"
+    struct Header {
+        std::atomic<uint64_t> ready;
+        uint32_t islands, slots, slotBytes;
+    };
+//the positions are on cache lines of their own so that senders and
+//    receivers do not fight over one
+    struct Inbox {
+        std::atomic<uint64_t> sendPos;
+        char padding1[56];
+        std::atomic<uint64_t> receivePos;
+        char padding2[56];
+    };
+    struct Slot {
+        std::atomic<uint64_t> sequence;
+        uint32_t size;
+    };
+    void* memory;
+    size_t length;
+    Header* header;
+    static size_t headerBytes() {return 64;}
+    size_t slotStride() const {return (sizeof(Slot) + header->slotBytes + 63) / 64 * 64;}
+    size_t inboxBytes() const {return sizeof(Inbox) + header->slots * slotStride();}
+    static size_t totalBytes(unsigned islands, unsigned slots, unsigned slotBytes)
+    {
+        return headerBytes() + islands * (sizeof(Inbox) + slots * ((sizeof(Slot) + slotBytes + 63) / 64 * 64));
+    }
+    Inbox& inbox(unsigned island) const
+    {
+        return *(Inbox*)((char*)memory + headerBytes() + island * inboxBytes());
+    }
+    Slot& slot(unsigned island, uint64_t position) const
+    {
+        return *(Slot*)((char*)&inbox(island) + sizeof(Inbox) + (position % header->slots) * slotStride());
+    }
+    static uint8_t* payload(Slot& s) {return (uint8_t*)(&s + 1);}
+public:
+    MigrationChannel() : memory(nullptr), length(0), header(nullptr) {}
+    MigrationChannel(const MigrationChannel&) = delete;
+    MigrationChannel& operator = (const MigrationChannel&) = delete;
+    ~MigrationChannel() {close();}
+//open the channel called name (a name for shm_open, e.g. "/evol"), making it
+//    with the given shape if no process has yet; one that exists must have
+//    the same shape.  False if it cannot be made or opened, or takes longer
+//    than timeout to be set up by the process that made it
+    bool open(const std::string& name, unsigned islands, unsigned slots = 64, unsigned slotBytes = 16384,
+              std::chrono::milliseconds timeout = std::chrono::milliseconds(5000))
+    {
+        close();
+        if( islands == 0 or slots == 0 ) return false;
+        size_t size = totalBytes(islands, slots, slotBytes);
+        bool making = true;
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if( fd < 0 )
+        {
+            making = false;
+            fd = shm_open(name.c_str(), O_RDWR, 0600);
+        }
+        if( fd < 0 ) return false;
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        if( making and ftruncate(fd, size) != 0 )
+        {
+            ::close(fd);
+            shm_unlink(name.c_str());
+            return false;
+        }
+        //the maker may not have sized it yet
+        struct stat info;
+        while( !making and (fstat(fd, &info) != 0 or size_t(info.st_size) < size) )
+        {
+            if( std::chrono::steady_clock::now() >= deadline )
+            {
+                ::close(fd);
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if( mapped == MAP_FAILED ) return false;
+        memory = mapped;
+        length = size;
+        header = (Header*)memory;
+        if( making )
+        {
+            new (&header->ready) std::atomic<uint64_t>(0);
+            header->islands = islands;
+            header->slots = slots;
+            header->slotBytes = slotBytes;
+            for(unsigned i = 0; i < islands; ++i)
+            {
+                new (&inbox(i).sendPos) std::atomic<uint64_t>(0);
+                new (&inbox(i).receivePos) std::atomic<uint64_t>(0);
+                for(uint64_t s = 0; s < slots; ++s)
+                    new (&slot(i, s).sequence) std::atomic<uint64_t>(s);
+            }
+            header->ready.store(MAGIC, std::memory_order_release);
+            return true;
+        }
+        while( header->ready.load(std::memory_order_acquire) != MAGIC and std::chrono::steady_clock::now() < deadline )
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if( header->ready.load(std::memory_order_acquire) != MAGIC or header->islands != islands or
+            header->slots != slots or header->slotBytes != slotBytes )
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+    void close()
+    {
+        if( memory ) munmap(memory, length);
+        memory = nullptr;
+        header = nullptr;
+    }
+    bool isOpen() const {return memory != nullptr;}
+//remove the name; processes that have it open keep it until they close it
+    static bool unlink(const std::string& name) {return shm_unlink(name.c_str()) == 0;}
+    unsigned getIslandCount() const {return header->islands;}
+    unsigned getSlotBytes() const {return header->slotBytes;}
+//put size bytes of data in the inbox of island; false if they do not fit
+//    in a slot or the inbox is full
+    bool send(unsigned island, const uint8_t* data, size_t size)
+    {
+        if( island >= header->islands or size > header->slotBytes ) return false;
+        Inbox& box = inbox(island);
+        uint64_t pos = box.sendPos.load(std::memory_order_relaxed);
+        for(;;)
+        {
+            Slot& s = slot(island, pos);
+            int64_t diff = int64_t(s.sequence.load(std::memory_order_acquire) - pos);
+            if( diff == 0 and box.sendPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed) )
+            {
+                s.size = size;
+                std::memcpy(payload(s), data, size);
+                s.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+            if( diff < 0 ) return false;
+            if( diff > 0 ) pos = box.sendPos.load(std::memory_order_relaxed);
+        }
+    }
+    bool send(unsigned island, const std::vector<uint8_t>& data) {return send(island, data.data(), data.size());}
+//take the oldest message from the inbox of island into out; false if it is empty
+    bool receive(unsigned island, std::vector<uint8_t>& out)
+    {
+        if( island >= header->islands ) return false;
+        Inbox& box = inbox(island);
+        uint64_t pos = box.receivePos.load(std::memory_order_relaxed);
+        for(;;)
+        {
+            Slot& s = slot(island, pos);
+            int64_t diff = int64_t(s.sequence.load(std::memory_order_acquire) - (pos + 1));
+            if( diff == 0 and box.receivePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed) )
+            {
+                out.assign(payload(s), payload(s) + s.size);
+                s.sequence.store(pos + header->slots, std::memory_order_release);
+                return true;
+            }
+            if( diff < 0 ) return false;
+            if( diff > 0 ) pos = box.receivePos.load(std::memory_order_relaxed);
+        }
+    }
+};
+
+//one island of an island model: a steady-state population of its own that,
+//    every interval evaluations, sends copies of its best members to the
+//    islands the topology says and takes in whatever migrants have arrived.
+//    Migrants travel in GenomeFormat through a MigrationChannel, so the
+//    islands can be separate processes
+class Island {
+public:
+    struct EpochReport {
+        SteadyState::RunReport run;
+//migrants sent, migrants turned away by full inboxes (or too big for a
+//    slot), migrants received, and how many of those got in
+        size_t sent, dropped, received, accepted;
+    };
+private:
+    SteadyState& evolver;
+    MigrationChannel& channel;
+    unsigned index;
+    MigrationTopology topology;
+    size_t interval, migrants;
+public:
+    Island(SteadyState& e, MigrationChannel& c, unsigned i, const MigrationTopology& t,
+           size_t everyEvaluations = 1000, size_t migrantCount = 2) :
+        evolver(e), channel(c), index(i), topology(t), interval(everyEvaluations), migrants(migrantCount) {}
+    unsigned getIndex() const {return index;}
+    void setInterval(size_t everyEvaluations) {interval = everyEvaluations;}
+    void setMigrantCount(size_t count) {migrants = count;}
+//send our best members out, without running
+    EpochReport emigrate()
+    {
+        EpochReport r = {SteadyState::RunReport(), 0, 0, 0, 0};
+        if( index >= topology.getIslandCount() ) return r;
+        for(size_t slot : evolver.getBestSlots(migrants))
+        {
+            std::vector<uint8_t> bytes;
+            if( !GenomeFormat::encode(evolver.getMember(slot).creature, bytes) ) continue;
+            for(unsigned target : topology.targets[index])
+                ++(channel.send(target, bytes) ? r.sent : r.dropped);
+        }
+        return r;
+    }
+//take in the migrants waiting for us, without running
+    EpochReport immigrate()
+    {
+        EpochReport r = {SteadyState::RunReport(), 0, 0, 0, 0};
+        std::vector<Creature> arrivals;
+        std::vector<uint8_t> bytes;
+        while( channel.receive(index, bytes) )
+        {
+            Creature c;
+            if( GenomeFormat::decode(bytes, c) ) arrivals.push_back(std::move(c));
+        }
+        r.received = arrivals.size();
+        r.accepted = evolver.offer(arrivals);
+        return r;
+    }
+//run interval evaluations, then migrate both ways
+    EpochReport epoch()
+    {
+        SteadyState::RunReport run = evolver.run(interval);
+        EpochReport out = emigrate(), in = immigrate();
+        out.run = run;
+        out.received = in.received;
+        out.accepted = in.accepted;
+        return out;
+    }
+};
+
+//run island(i) for every i below count, each in a process of its own: this
+//    process is island 0 and the rest are forked from it.  Returns once all
+//    of them are done, true if every one returned 0.  Fork before making any
+//    ThreadPool, since a child gets none of its parent's threads
+inline bool forkIslands(unsigned count, std::function<int(unsigned)> island)
+{
+    std::vector<pid_t> children;
+    //anything still buffered would be written once by every process
+    std::fflush(nullptr);
+    for(unsigned i = 1; i < count; ++i)
+    {
+        pid_t pid = fork();
+        if( pid == 0 )
+        {
+            int status = island(i);
+            std::fflush(nullptr);
+            _exit(status);
+        }
+        if( pid > 0 ) children.push_back(pid);
+    }
+    bool ok = children.size() + 1 == std::max(count, 1u) and island(0) == 0;
+    for(pid_t pid : children)
+    {
+        int status = 0;
+        ok = waitpid(pid, &status, 0) == pid and WIFEXITED(status) and WEXITSTATUS(status) == 0 and ok;
+    }
+    return ok;
+}
+
+}; //namespace EVOL_NS
+
+#endif
@@ -0,0 +1,249 @@
+#ifndef _KD_TREE_H__
+#define _KD_TREE_H__
+
+#include "config.h"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "ThreadPool.h"
+
+namespace EVOL_NS {
+
+//nearest neighbour search over points with a fixed number of dimensions,
+//    which can be added to at any time.  New points wait in a small buffer
+//    that is searched by brute force; when it fills, it is merged with the
+//    levels below into one balanced tree (Bentley and Saxe's logarithmic
+//    method), so level i is either empty or holds BUFFER_SIZE * 2^i points.
+//    Adding stays cheap on average and every tree stays balanced whatever
+//    order points arrive in.  Searches may run from many threads at once, but
+//    not while points are being added
+class KdTree {
+public:
+    typedef uint32_t IndexTy;
+    static const IndexTy NONE = IndexTy(-1);
+//one result of a search: a point, by the order it was added in
+    struct Neighbour {
+        double distanceSquared;
+        IndexTy index;
+        bool operator < (const Neighbour& other) const
+        {
+            return distanceSquared < other.distanceSquared or
+                   (distanceSquared == other.distanceSquared and index < other.index);
+        }
+    };
+private:
+    static const size_t LEAF_SIZE = 16;
+    static const size_t BUFFER_SIZE = 64;
+//a static tree; its points are stored in tree order, and node k covers
+//    points begin up to end, split at split along dimension dim between
+//    children left (below) and right (above).  Leaves have left == 0
+    struct Node {
+        size_t begin, end;
+        unsigned dim;
+        double split;
+        uint32_t left, right;
+    };
+    struct Level {
+        std::vector<double> coords;
+        std::vector<IndexTy> ids;
+        std::vector<Node> nodes;
+    };
+    unsigned dims;
+    size_t count;
+    Level buffer;
+    std::vector<Level> levels;
+//median split along the widest dimension; order holds point numbers into
+//    coords and is rearranged into tree order
+    uint32_t build(Level& level, std::vector<size_t>& order, const std::vector<double>& coords, size_t begin, size_t end)
+    {
+        uint32_t node = level.nodes.size();
+        level.nodes.push_back(Node{begin, end, 0, 0.0, 0, 0});
+        if( end - begin <= LEAF_SIZE ) return node;
+        unsigned widestDim = 0;
+        double widest = -1.0;
+        for(unsigned d = 0; d < dims; ++d)
+        {
+            double lo = coords[order[begin] * dims + d], hi = lo;
+            for(size_t i = begin + 1; i < end; ++i)
+            {
+                double v = coords[order[i] * dims + d];
+                lo = std::min(lo, v);
+                hi = std::max(hi, v);
+            }
+            if( hi - lo > widest )
+            {
+                widest = hi - lo;
+                widestDim = d;
+            }
+        }
+        size_t mid = (begin + end) / 2;
+        std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end, [&](size_t a, size_t b) {
+            return coords[a * dims + widestDim] < coords[b * dims + widestDim];
+        });
+        double split = coords[order[mid] * dims + widestDim];
+        uint32_t left = build(level, order, coords, begin, mid);
+        uint32_t right = build(level, order, coords, mid, end);
+        Node& n = level.nodes[node];
+        n.dim = widestDim;
+        n.split = split;
+        n.left = left;
+        n.right = right;
+        return node;
+    }
+    void buildLevel(Level& level, std::vector<double>& coords, std::vector<IndexTy>& ids)
+    {
+        std::vector<size_t> order(ids.size());
+        for(size_t i = 0; i < order.size(); ++i)
+            order[i] = i;
+        level.nodes.clear();
+        build(level, order, coords, 0, order.size());
+        level.coords.resize(coords.size());
+        level.ids.resize(ids.size());
+        for(size_t i = 0; i < order.size(); ++i)
+        {
+            std::copy(coords.begin() + order[i] * dims, coords.begin() + (order[i] + 1) * dims, level.coords.begin() + i * dims);
+            level.ids[i] = ids[order[i]];
+        }
+    }
+//merge the buffer down into the first empty level
+    void flush()
+    {
+        std::vector<double> coords;
+        std::vector<IndexTy> ids;
+        coords.swap(buffer.coords);
+        ids.swap(buffer.ids);
+        for(size_t i = 0; ; ++i)
+        {
+            if( i == levels.size() ) levels.push_back(Level());
+            Level& level = levels[i];
+            if( level.ids.empty() )
+            {
+                buildLevel(level, coords, ids);
+                return;
+            }
+            coords.insert(coords.end(), level.coords.begin(), level.coords.end());
+            ids.insert(ids.end(), level.ids.begin(), level.ids.end());
+            level = Level();
+        }
+    }
+//the k best so far are kept as a max-heap in best
+    struct Search {
+        const double* query;
+        unsigned k;
+        IndexTy skip;
+        std::vector<Neighbour> best;
+        std::vector<double> offset;
+        double worst() const
+        {
+            return best.size() < k ? std::numeric_limits<double>::infinity() : best.front().distanceSquared;
+        }
+        void offer(double distanceSquared, IndexTy index)
+        {
+            if( index == skip ) return;
+            Neighbour n = {distanceSquared, index};
+            if( best.size() < k )
+            {
+                best.push_back(n);
+                std::push_heap(best.begin(), best.end());
+            }
+            else if( n < best.front() )
+            {
+                std::pop_heap(best.begin(), best.end());
+                best.back() = n;
+                std::push_heap(best.begin(), best.end());
+            }
+        }
+    };
+    void scan(const Level& level, size_t begin, size_t end, Search& search) const
+    {
+        for(size_t i = begin; i < end; ++i)
+        {
+            const double* p = &level.coords[i * dims];
+            double distanceSquared = 0.0;
+            for(unsigned d = 0; d < dims; ++d)
+            {
+                double diff = p[d] - search.query[d];
+                distanceSquared += diff * diff;
+            }
+            if( distanceSquared < search.worst() )
+                search.offer(distanceSquared, level.ids[i]);
+        }
+    }
+//the far side of a split is only searched when the box around it can hold
+//    something nearer than the worst kept so far; reach is the squared
+//    distance to that box, built up one split at a time (Arya and Mount's
+//    incremental distance), with offset[d] the part of it along d
+    void descend(const Level& level, uint32_t node, double reach, Search& search) const
+    {
+        const Node& n = level.nodes[node];
+        if( n.left == 0 )
+        {
+            scan(level, n.begin, n.end, search);
+            return;
+        }
+        double diff = search.query[n.dim] - n.split;
+        descend(level, diff < 0 ? n.left : n.right, reach, search);
+        double old = search.offset[n.dim];
+        double farReach = reach - old * old + diff * diff;
+        if( farReach < search.worst() )
+        {
+            search.offset[n.dim] = diff;
+            descend(level, diff < 0 ? n.right : n.left, farReach, search);
+            search.offset[n.dim] = old;
+        }
+    }
+public:
+    KdTree(unsigned dimensions) : dims(dimensions), count(0) {}
+    unsigned getDimensions() const {return dims;}
+    size_t size() const {return count;}
+//add a point of getDimensions() values; returns its index
+    IndexTy add(const double* point)
+    {
+        buffer.coords.insert(buffer.coords.end(), point, point + dims);
+        buffer.ids.push_back(count);
+        if( buffer.ids.size() == BUFFER_SIZE )
+            flush();
+        return count++;
+    }
+//the k points nearest query (never the one numbered skip), nearest first,
+//    into out; returns how many were found, which is fewer than k only when
+//    there are not enough points
+    size_t nearest(const double* query, unsigned k, Neighbour* out, IndexTy skip = NONE) const
+    {
+        Search search = {query, k, skip, std::vector<Neighbour>(), std::vector<double>(dims, 0.0)};
+        if( k == 0 ) return 0;
+        search.best.reserve(k);
+        scan(buffer, 0, buffer.ids.size(), search);
+        for(const Level& level : levels)
+            if( !level.ids.empty() )
+                descend(level, 0, 0.0, search);
+        std::sort_heap(search.best.begin(), search.best.end());
+        std::copy(search.best.begin(), search.best.end(), out);
+        return search.best.size();
+    }
+//nearest() for count queries at once, split across pool if given.  The
+//    results of query q go to out[q*k] onwards, with any not found having
+//    index NONE; skip, if given, has one entry per query
+    void nearest(const double* queries, size_t queryCount, unsigned k, Neighbour* out,
+                 ThreadPool* pool = nullptr, const IndexTy* skip = nullptr) const
+    {
+        auto run = [&](size_t begin, size_t end, unsigned) {
+            for(size_t q = begin; q < end; ++q)
+            {
+                Neighbour* results = out + q * k;
+                size_t found = nearest(queries + q * dims, k, results, skip ? skip[q] : IndexTy(NONE));
+                for(size_t i = found; i < k; ++i)
+                    results[i] = Neighbour{std::numeric_limits<double>::infinity(), NONE};
+            }
+        };
+        if( pool )
+            pool->parallelFor(queryCount, run);
+        else
+            run(0, queryCount, 0);
+    }
+};
+
+}; //namespace EVOL_NS
+
+#endif
@@ -0,0 +1,256 @@
+#ifndef _MAP_ELITES_H__
+#define _MAP_ELITES_H__
+
+#include "config.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Creature.h"
+#include "Evaluation.h"
+#include "ThreadPool.h"
+
+namespace EVOL_NS {
+
+//a grid over behaviour space where each cell keeps the fittest creature
+//    whose behaviour fell in it.  Cells are guarded by a fixed set of striped
+//    locks rather than one lock for the grid, so many threads can insert at
+//    once; a candidate no better than its cell's elite is turned away by an
+//    atomic read without taking any lock at all
+class EliteGrid {
+public:
+    struct Cell {
+        Creature elite;
+        Evaluation evaluation;
+    };
+private:
+    struct Axis {
+        double lo, hi;
+        size_t bins;
+    };
+//each stripe also keeps the count and fitness sum of its filled cells, so the
+//    totals are a sum over the stripes rather than over every cell.  Padded
+//    so that two stripes never share a cache line
+    struct Stripe {
+        std::mutex mutex;
+        size_t filled;
+        double fitnessSum;
+        char padding[64];
+        Stripe() : filled(0), fitnessSum(0.0) {}
+    };
+    std::vector<Axis> axes;
+    size_t cellCount;
+//-infinity for an empty cell
+    std::unique_ptr<std::atomic<double>[]> bestFitness;
+    std::vector<std::unique_ptr<Cell>> cells;
+    std::unique_ptr<Stripe[]> stripes;
+    size_t stripeCount;
+//QD-score counts each elite's fitness above this
+    double fitnessFloor;
+    Stripe& stripeOf(size_t cell) const {return stripes[cell % stripeCount];}
+//empty every cell
+    void reset()
+    {
+        bestFitness.reset(new std::atomic<double>[cellCount]);
+        for(size_t c = 0; c < cellCount; ++c)
+            bestFitness[c].store(-std::numeric_limits<double>::infinity());
+        cells.clear();
+        cells.resize(cellCount);
+        stripes.reset(new Stripe[stripeCount]);
+    }
+public:
+    static const size_t NO_CELL = size_t(-1);
+//an empty grid with no axes, which is a single cell; add them with
+//    addAxis() before inserting
+    EliteGrid(size_t locks = 64, double floor = 0.0) :
+        cellCount(1), stripeCount(std::max<size_t>(1, locks)), fitnessFloor(floor)
+    {
+        reset();
+    }
+//behaviour value d is split into bins between lo and hi, values outside going
+//    to the end bins; empties the grid.  False, and nothing changed, unless
+//    there is at least one bin and hi is above lo
+    bool addAxis(double lo, double hi, size_t bins)
+    {
+        if( bins == 0 or !(hi > lo) or !std::isfinite(hi - lo) ) return false;
+        axes.push_back(Axis{lo, hi, bins});
+        cellCount *= bins;
+        reset();
+        return true;
+    }
+    size_t getAxisCount() const {return axes.size();}
+    size_t getCellCount() const {return cellCount;}
+//the cell a behaviour falls in, or NO_CELL if it is too short (or NaN)
+    size_t cellOf(const std::vector<double>& behaviour) const
+    {
+        if( behaviour.size() < axes.size() ) return NO_CELL;
+        size_t cell = 0;
+        for(size_t d = 0; d < axes.size(); ++d)
+        {
+            const Axis& axis = axes[d];
+            double t = (behaviour[d] - axis.lo) / (axis.hi - axis.lo);
+            if( t != t ) return NO_CELL;
+            size_t bin = t <= 0 ? 0 : std::min(axis.bins - 1, size_t(t * axis.bins));
+            cell = cell * axis.bins + bin;
+        }
+        return cell;
+    }
+//make creature the elite of its cell if it beats the one there; true if it
+//    did.  Runs that were terminated (or diverged) never get in.  Safe to
+//    call from any number of threads at once
+    bool insert(const Creature& creature, const Evaluation& evaluation)
+    {
+        size_t cell = cellOf(evaluation.behaviour);
+        if( cell == NO_CELL or evaluation.terminated or evaluation.fitness != evaluation.fitness ) return false;
+        if( evaluation.fitness <= bestFitness[cell].load(std::memory_order_relaxed) ) return false;
+        Stripe& stripe = stripeOf(cell);
+        std::lock_guard<std::mutex> lock(stripe.mutex);
+        double old = bestFitness[cell].load(std::memory_order_relaxed);
+        if( evaluation.fitness <= old ) return false; //beaten to it
+        if( cells[cell] )
+            stripe.fitnessSum -= old - fitnessFloor;
+        else
+        {
+            cells[cell].reset(new Cell);
+            ++stripe.filled;
+        }
+        cells[cell]->elite = creature;
+        cells[cell]->evaluation = evaluation;
+        stripe.fitnessSum += evaluation.fitness - fitnessFloor;
+        bestFitness[cell].store(evaluation.fitness, std::memory_order_relaxed);
+        return true;
+    }
+//a copy of the elite of cell; false if the cell is empty
+    bool getElite(size_t cell, Creature& out, Evaluation* evaluation = nullptr) const
+    {
+        std::lock_guard<std::mutex> lock(stripeOf(cell).mutex);
+        if( !cells[cell] ) return false;
+        out = cells[cell]->elite;
+        if( evaluation ) *evaluation = cells[cell]->evaluation;
+        return true;
+    }
+    double getFitness(size_t cell) const {return bestFitness[cell].load(std::memory_order_relaxed);}
+    bool isFilled(size_t cell) const {return getFitness(cell) != -std::numeric_limits<double>::infinity();}
+//the cells that have an elite right now
+    std::vector<size_t> getFilledCells() const
+    {
+        std::vector<size_t> filled;
+        for(size_t c = 0; c < cellCount; ++c)
+            if( isFilled(c) ) filled.push_back(c);
+        return filled;
+    }
+    size_t getFilledCount() const
+    {
+        size_t filled = 0;
+        for(size_t s = 0; s < stripeCount; ++s)
+        {
+            std::lock_guard<std::mutex> lock(stripes[s].mutex);
+            filled += stripes[s].filled;
+        }
+        return filled;
+    }
+//the fraction of cells filled
+    double getCoverage() const {return double(getFilledCount()) / cellCount;}
+//the sum over the filled cells of their elite's fitness above the floor
+    double getQdScore() const
+    {
+        double sum = 0.0;
+        for(size_t s = 0; s < stripeCount; ++s)
+        {
+            std::lock_guard<std::mutex> lock(stripes[s].mutex);
+            sum += stripes[s].fitnessSum;
+        }
+        return sum;
+    }
+};
+
+//the MAP-Elites loop: every batch picks random elites from the grid, varies
+//    them, evaluates the children in parallel and offers each to the grid as
+//    soon as it is done.  The evaluator must have a behaviour function whose
+//    first values are the grid's axes, and the variation function must be
+//    safe to call from several threads at once
+class MapElites {
+public:
+    struct BatchReport {
+        size_t evaluated, inserted;
+        double coverage, qdScore, bestFitness;
+    };
+private:
+    EliteGrid& grid;
+    const Evaluator& evaluator;
+    VariationFn vary;
+    ThreadPool* pool;
+    SimulationContext::RngTy rng;
+    Evaluator::SeedTy seed;
+    BatchReport report(size_t evaluated, size_t inserted) const
+    {
+        BatchReport r = {evaluated, inserted, grid.getCoverage(), grid.getQdScore(), -std::numeric_limits<double>::infinity()};
+        for(size_t c = 0; c < grid.getCellCount(); ++c)
+            r.bestFitness = std::max(r.bestFitness, grid.getFitness(c));
+        return r;
+    }
+public:
+//evaluations all use the same seed, so a creature's fitness depends on it alone
+    MapElites(EliteGrid& g, const Evaluator& e, VariationFn v, ThreadPool* p = nullptr,
+              SimulationContext::RngTy::result_type rngSeed = SimulationContext::RngTy::default_seed) :
+        grid(g), evaluator(e), vary(v), pool(p), rng(rngSeed), seed(SimulationContext::RngTy::default_seed) {}
+    void setEvaluationSeed(Evaluator::SeedTy s) {seed = s;}
+//evaluate a starting population and offer it to the grid as is
+    BatchReport seedWith(const std::vector<Creature>& population)
+    {
+        std::atomic<size_t> inserted(0);
+        auto run = [&](size_t begin, size_t end, unsigned) {
+            for(size_t i = begin; i < end; ++i)
+                if( grid.insert(population[i], evaluator.evaluate(population[i], seed)) )
+                    ++inserted;
+        };
+        if( pool )
+            pool->parallelFor(population.size(), run);
+        else
+            run(0, population.size(), 0);
+        return report(population.size(), inserted);
+    }
+//one batch of size children; nothing happens while the grid is empty
+    BatchReport runBatch(size_t size)
+    {
+        std::vector<size_t> filled = grid.getFilledCells();
+        if( filled.empty() ) return report(0, 0);
+        //every child gets its own generator, and its parent is picked and
+        //    copied out of the grid here, before any child of this batch can
+        //    replace it; so the children are the same however the batch is
+        //    split between threads (though which of two equally fit children
+        //    keeps a cell still depends on which got there first)
+        std::vector<SimulationContext::RngTy> childRngs;
+        std::vector<size_t> parentOf(size);
+        std::vector<Creature> parents(filled.size());
+        std::vector<char> copied(filled.size(), 0);
+        for(size_t i = 0; i < size; ++i)
+        {
+            childRngs.push_back(SimulationContext::RngTy(rng()));
+            parentOf[i] = std::uniform_int_distribution<size_t>(0, filled.size() - 1)(childRngs[i]);
+            if( !copied[parentOf[i]] ) grid.getElite(filled[parentOf[i]], parents[parentOf[i]]);
+            copied[parentOf[i]] = 1;
+        }
+        std::atomic<size_t> inserted(0);
+        auto run = [&](size_t begin, size_t end, unsigned) {
+            for(size_t i = begin; i < end; ++i)
+            {
+                Creature child = vary(parents[parentOf[i]], childRngs[i]);
+                if( grid.insert(child, evaluator.evaluate(child, seed)) )
+                    ++inserted;
+            }
+        };
+        if( pool )
+            pool->parallelFor(size, run);
+        else
+            run(0, size, 0);
+        return report(size, inserted);
+    }
+};
+
+}; //namespace EVOL_NS
+
+#endif
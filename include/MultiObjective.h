@@ -0,0 +1,418 @@
+#ifndef _MULTI_OBJECTIVE_H__
+#define _MULTI_OBJECTIVE_H__
+
+#include "config.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <random>
+#include <vector>
+#include "FitnessCache.h"
+
+namespace EVOL_NS {
+
+//everything here works on packed objectives: count candidates with m
+//    values each, candidate i's at objectives[i*m] onwards, higher being
+//    better for every one of them (as with fitness).  NaN counts as the
+//    worst possible value
+
+//the objectives of a batch of evaluations, packed; ones with too few are
+//    padded with -infinity
+inline std::vector<double> packObjectives(const std::vector<Evaluation>& results, unsigned m)
+{
+    std::vector<double> packed(results.size() * m, -std::numeric_limits<double>::infinity());
+    for(size_t i = 0; i < results.size(); ++i)
+    {
+        const std::vector<double>& o = results[i].objectives;
+        std::copy(o.begin(), o.begin() + std::min<size_t>(o.size(), m), packed.begin() + i * m);
+    }
+    return packed;
+}
+
+//sort candidates into Pareto fronts: rank[i] is 0 for those no other
+//    candidate dominates, 1 for those only candidates of rank 0 dominate, and
+//    so on.  Returns the number of fronts.
+//    For 2 and 3 objectives this is a sweep in decreasing order of the first
+//    objective: every candidate before one is at least as good in it, so
+//    only the others need checking, and a candidate's front is found by
+//    binary search over the fronts (a candidate dominated by someone in front
+//    k is also dominated by someone in every front before k).  For 2
+//    objectives a front only needs its best second objective, making the
+//    sort O(N log N); for 3 each front keeps the staircase of its best
+//    (second, third) pairs in a map, making it O(N log^2 N).  More objectives
+//    fall back to Deb's O(M N^2) sort
+inline size_t nonDominatedSort(const double* objectives, size_t count, unsigned m, uint32_t* rank)
+{
+    if( count == 0 ) return 0;
+    auto value = [&](size_t i, unsigned d) {
+        double v = objectives[i * m + d];
+        return v != v ? -std::numeric_limits<double>::infinity() : v;
+    };
+    if( m == 1 )
+    {
+        //one objective: fronts are the distinct values, best first
+        std::vector<size_t> order(count);
+        std::iota(order.begin(), order.end(), size_t(0));
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {return value(a, 0) > value(b, 0);});
+        uint32_t front = 0;
+        for(size_t i = 0; i < count; ++i)
+        {
+            if( i > 0 and value(order[i], 0) < value(order[i - 1], 0) ) ++front;
+            rank[order[i]] = front;
+        }
+        return front + 1;
+    }
+    if( m > 3 )
+    {
+        std::vector<std::vector<size_t>> dominates(count);
+        std::vector<size_t> dominatedBy(count, 0), current, next;
+        for(size_t a = 0; a < count; ++a)
+            for(size_t b = a + 1; b < count; ++b)
+            {
+                bool aBetter = false, bBetter = false;
+                for(unsigned d = 0; d < m; ++d)
+                {
+                    aBetter = aBetter or value(a, d) > value(b, d);
+                    bBetter = bBetter or value(b, d) > value(a, d);
+                }
+                if( aBetter and !bBetter ) {dominates[a].push_back(b); ++dominatedBy[b];}
+                if( bBetter and !aBetter ) {dominates[b].push_back(a); ++dominatedBy[a];}
+            }
+        for(size_t i = 0; i < count; ++i)
+            if( dominatedBy[i] == 0 ) current.push_back(i);
+        uint32_t front = 0;
+        for(; !current.empty(); ++front)
+        {
+            next.clear();
+            for(size_t a : current)
+            {
+                rank[a] = front;
+                for(size_t b : dominates[a])
+                    if( --dominatedBy[b] == 0 ) next.push_back(b);
+            }
+            current.swap(next);
+        }
+        return front;
+    }
+    std::vector<size_t> order(count);
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        for(unsigned d = 0; d < m; ++d)
+            if( value(a, d) != value(b, d) ) return value(a, d) > value(b, d);
+        return false;
+    });
+    auto same = [&](size_t a, size_t b) {
+        for(unsigned d = 0; d < m; ++d)
+            if( value(a, d) != value(b, d) ) return false;
+        return true;
+    };
+    //candidates with identical objectives do not dominate each other, so
+    //    each run of them is placed once; among distinct ones, a candidate
+    //    earlier in the order dominates a later one exactly when it is at
+    //    least as good in the remaining objectives
+    if( m == 2 )
+    {
+        std::vector<double> best;
+        for(size_t i = 0; i < count; ++i)
+        {
+            size_t c = order[i];
+            if( i > 0 and same(c, order[i - 1]) )
+            {
+                rank[c] = rank[order[i - 1]];
+                continue;
+            }
+            double v = value(c, 1);
+            //best is in decreasing order, so this is the first front whose
+            //    best second objective is below ours
+            size_t front = std::upper_bound(best.begin(), best.end(), v, std::greater<double>()) - best.begin();
+            if( front == best.size() ) best.push_back(v);
+            else best[front] = std::max(best[front], v);
+            rank[c] = front;
+        }
+        return best.size();
+    }
+    //each front's staircase: second objective increasing, third decreasing
+    std::vector<std::map<double,double>> stairs;
+    auto dominatedIn = [&](const std::map<double,double>& stair, double v1, double v2) {
+        auto above = stair.lower_bound(v1);
+        return above != stair.end() and above->second >= v2;
+    };
+    for(size_t i = 0; i < count; ++i)
+    {
+        size_t c = order[i];
+        if( i > 0 and same(c, order[i - 1]) )
+        {
+            rank[c] = rank[order[i - 1]];
+            continue;
+        }
+        double v1 = value(c, 1), v2 = value(c, 2);
+        size_t lo = 0, hi = stairs.size();
+        while( lo < hi )
+        {
+            size_t mid = (lo + hi) / 2;
+            if( dominatedIn(stairs[mid], v1, v2) ) lo = mid + 1;
+            else hi = mid;
+        }
+        if( lo == stairs.size() ) stairs.push_back(std::map<double,double>());
+        std::map<double,double>& stair = stairs[lo];
+        //drop the steps we now cover, then add ours
+        auto step = stair.upper_bound(v1);
+        while( step != stair.begin() )
+        {
+            auto before = std::prev(step);
+            if( before->second > v2 ) break;
+            step = stair.erase(before);
+        }
+        stair[v1] = v2;
+        rank[c] = lo;
+    }
+    return stairs.size();
+}
+
+//the candidates of each front, best front first
+inline std::vector<std::vector<size_t>> frontsOf(const uint32_t* rank, size_t count)
+{
+    std::vector<std::vector<size_t>> fronts;
+    for(size_t i = 0; i < count; ++i)
+    {
+        if( rank[i] >= fronts.size() ) fronts.resize(rank[i] + 1);
+        fronts[rank[i]].push_back(i);
+    }
+    return fronts;
+}
+
+//NSGA-II's crowding distance of each candidate within its own front: the
+//    sum over objectives of the gap between its neighbours either side,
+//    relative to the front's spread; the ends of a front get infinity
+inline void crowdingDistance(const double* objectives, size_t count, unsigned m, const uint32_t* rank, double* distance)
+{
+    std::fill(distance, distance + count, 0.0);
+    std::vector<std::vector<size_t>> fronts = frontsOf(rank, count);
+    for(std::vector<size_t>& front : fronts)
+        for(unsigned d = 0; d < m; ++d)
+        {
+            auto value = [&](size_t i) {
+                double v = objectives[i * m + d];
+                return v != v ? -std::numeric_limits<double>::infinity() : v;
+            };
+            std::sort(front.begin(), front.end(), [&](size_t a, size_t b) {return value(a) < value(b);});
+            double spread = value(front.back()) - value(front.front());
+            distance[front.front()] = distance[front.back()] = std::numeric_limits<double>::infinity();
+            if( !(spread > 0) or std::isinf(spread) ) continue;
+            for(size_t k = 1; k + 1 < front.size(); ++k)
+                distance[front[k]] += (value(front[k + 1]) - value(front[k - 1])) / spread;
+        }
+}
+
+//NSGA-II survivor selection: the keep best candidates by front, with the
+//    last front that only partly fits taken in decreasing crowding distance
+inline std::vector<size_t> selectNsga2(const double* objectives, size_t count, unsigned m, size_t keep)
+{
+    std::vector<uint32_t> rank(count);
+    std::vector<double> distance(count);
+    nonDominatedSort(objectives, count, m, rank.data());
+    crowdingDistance(objectives, count, m, rank.data(), distance.data());
+    std::vector<size_t> chosen;
+    for(std::vector<size_t>& front : frontsOf(rank.data(), count))
+    {
+        if( chosen.size() >= keep ) break;
+        if( chosen.size() + front.size() > keep )
+        {
+            std::sort(front.begin(), front.end(), [&](size_t a, size_t b) {
+                return distance[a] > distance[b] or (distance[a] == distance[b] and a < b);
+            });
+            front.resize(keep - chosen.size());
+        }
+        chosen.insert(chosen.end(), front.begin(), front.end());
+    }
+    return chosen;
+}
+
+//Das and Dennis's structured reference points for NSGA-III: every point of
+//    the unit simplex in m dimensions whose coordinates are multiples of
+//    1/divisions, packed m values each
+inline std::vector<double> referencePoints(unsigned m, unsigned divisions)
+{
+    std::vector<double> points;
+    std::vector<unsigned> parts(m, 0);
+    std::function<void(unsigned, unsigned)> fill = [&](unsigned d, unsigned left) {
+        if( d + 1 == m )
+        {
+            parts[d] = left;
+            for(unsigned p : parts)
+                points.push_back(divisions ? double(p) / divisions : 1.0 / m);
+            return;
+        }
+        for(unsigned p = 0; p <= left; ++p)
+        {
+            parts[d] = p;
+            fill(d + 1, left - p);
+        }
+    };
+    if( m > 0 ) fill(0, divisions);
+    return points;
+}
+
+//NSGA-III survivor selection: as NSGA-II up to the last front that only
+//    partly fits, which is then filled by niching instead of crowding.
+//    Objectives are normalized by the hyperplane through the extreme
+//    candidates, each candidate is associated with its nearest reference
+//    line, and the last front's places go to the reference points with the
+//    fewest candidates chosen so far, nearest first, ties broken by rng
+template<class RngTy>
+std::vector<size_t> selectNsga3(const double* objectives, size_t count, unsigned m, size_t keep,
+                                const std::vector<double>& references, RngTy& rng)
+{
+    std::vector<uint32_t> rank(count);
+    nonDominatedSort(objectives, count, m, rank.data());
+    std::vector<size_t> chosen, last;
+    for(std::vector<size_t>& front : frontsOf(rank.data(), count))
+    {
+        if( chosen.size() + front.size() > keep )
+        {
+            last = front;
+            break;
+        }
+        chosen.insert(chosen.end(), front.begin(), front.end());
+        if( chosen.size() == keep ) break;
+    }
+    size_t refCount = m ? references.size() / m : 0;
+    if( last.empty() or refCount == 0 ) return chosen;
+    //translate so the best of each objective is 0 and smaller is better
+    std::vector<size_t> considered = chosen;
+    considered.insert(considered.end(), last.begin(), last.end());
+    auto value = [&](size_t i, unsigned d) {
+        double v = objectives[i * m + d];
+        return v != v ? -std::numeric_limits<double>::infinity() : v;
+    };
+    std::vector<double> ideal(m, -std::numeric_limits<double>::infinity());
+    for(size_t i : considered)
+        for(unsigned d = 0; d < m; ++d)
+            ideal[d] = std::max(ideal[d], value(i, d));
+    std::vector<double> f(considered.size() * m);
+    for(size_t k = 0; k < considered.size(); ++k)
+        for(unsigned d = 0; d < m; ++d)
+        {
+            double v = ideal[d] - value(considered[k], d);
+            f[k * m + d] = std::isfinite(v) ? v : std::numeric_limits<double>::max();
+        }
+    //intercepts from the extreme points (those with the least achievement
+    //    scalarizing function along each axis), or the largest value of each
+    //    objective if they give no proper hyperplane
+    std::vector<double> intercept(m, 0.0), worst(m, 0.0);
+    for(size_t k = 0; k < considered.size(); ++k)
+        for(unsigned d = 0; d < m; ++d)
+            worst[d] = std::max(worst[d], f[k * m + d]);
+    std::vector<double> system(m * (m + 1));
+    for(unsigned axis = 0; axis < m; ++axis)
+    {
+        size_t extreme = 0;
+        double bestAsf = std::numeric_limits<double>::infinity();
+        for(size_t k = 0; k < considered.size(); ++k)
+        {
+            double asf = 0.0;
+            for(unsigned d = 0; d < m; ++d)
+                asf = std::max(asf, f[k * m + d] / (d == axis ? 1.0 : 1e-6));
+            if( asf < bestAsf ) {bestAsf = asf; extreme = k;}
+        }
+        for(unsigned d = 0; d < m; ++d)
+            system[axis * (m + 1) + d] = f[extreme * m + d];
+        system[axis * (m + 1) + m] = 1.0;
+    }
+    bool solved = true;
+    for(unsigned col = 0; col < m and solved; ++col)
+    {
+        unsigned pivot = col;
+        for(unsigned row = col + 1; row < m; ++row)
+            if( std::abs(system[row * (m + 1) + col]) > std::abs(system[pivot * (m + 1) + col]) ) pivot = row;
+        if( std::abs(system[pivot * (m + 1) + col]) < 1e-12 ) {solved = false; break;}
+        for(unsigned c = 0; c <= m; ++c)
+            std::swap(system[col * (m + 1) + c], system[pivot * (m + 1) + c]);
+        for(unsigned row = 0; row < m; ++row)
+        {
+            if( row == col ) continue;
+            double factor = system[row * (m + 1) + col] / system[col * (m + 1) + col];
+            for(unsigned c = col; c <= m; ++c)
+                system[row * (m + 1) + c] -= factor * system[col * (m + 1) + c];
+        }
+    }
+    for(unsigned d = 0; d < m; ++d)
+    {
+        double a = solved ? system[d * (m + 1) + m] / system[d * (m + 1) + d] : 0.0;
+        intercept[d] = a > 0 ? 1.0 / a : 0.0;
+        if( !(intercept[d] > 1e-10) or !std::isfinite(intercept[d]) ) intercept[d] = worst[d] > 0 ? worst[d] : 1.0;
+    }
+    //associate every candidate with the reference line it is nearest
+    std::vector<size_t> niche(considered.size());
+    std::vector<double> nicheDistance(considered.size());
+    for(size_t k = 0; k < considered.size(); ++k)
+    {
+        double bestDistance = std::numeric_limits<double>::infinity();
+        for(size_t r = 0; r < refCount; ++r)
+        {
+            const double* w = &references[r * m];
+            double dot = 0.0, norm = 0.0;
+            for(unsigned d = 0; d < m; ++d)
+            {
+                dot += f[k * m + d] / intercept[d] * w[d];
+                norm += w[d] * w[d];
+            }
+            double distanceSquared = 0.0;
+            for(unsigned d = 0; d < m; ++d)
+            {
+                double diff = f[k * m + d] / intercept[d] - (norm > 0 ? dot / norm : 0.0) * w[d];
+                distanceSquared += diff * diff;
+            }
+            if( distanceSquared < bestDistance ) {bestDistance = distanceSquared; niche[k] = r;}
+        }
+        nicheDistance[k] = bestDistance;
+    }
+    std::vector<size_t> nicheCount(refCount, 0);
+    for(size_t k = 0; k < chosen.size(); ++k)
+        ++nicheCount[niche[k]];
+    std::vector<std::vector<size_t>> waiting(refCount);
+    for(size_t k = chosen.size(); k < considered.size(); ++k)
+        waiting[niche[k]].push_back(k);
+    std::vector<bool> open(refCount, true);
+    std::vector<size_t> least;
+    while( chosen.size() < keep )
+    {
+        least.clear();
+        for(size_t r = 0; r < refCount; ++r)
+        {
+            if( !open[r] ) continue;
+            if( !least.empty() and nicheCount[r] < nicheCount[least[0]] ) least.clear();
+            if( least.empty() or nicheCount[r] == nicheCount[least[0]] ) least.push_back(r);
+        }
+        if( least.empty() ) break;
+        size_t r = least[std::uniform_int_distribution<size_t>(0, least.size() - 1)(rng)];
+        std::vector<size_t>& members = waiting[r];
+        if( members.empty() )
+        {
+            open[r] = false;
+            continue;
+        }
+        size_t pick = 0;
+        if( nicheCount[r] == 0 )
+        {
+            for(size_t p = 1; p < members.size(); ++p)
+                if( nicheDistance[members[p]] < nicheDistance[members[pick]] ) pick = p;
+        }
+        else
+            pick = std::uniform_int_distribution<size_t>(0, members.size() - 1)(rng);
+        chosen.push_back(considered[members[pick]]);
+        members[pick] = members.back();
+        members.pop_back();
+        ++nicheCount[r];
+    }
+    return chosen;
+}
+
+}; //namespace EVOL_NS
+
+#endif
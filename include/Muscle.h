@@ -2,6 +2,11 @@
 #define _MUSCLE_H__
 
 #include "config.h"
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <map>
 #include <memory>
 #include "Axon.h"
 #include "BodyPart.h"
@@ -14,58 +19,238 @@ UNIT_ADD(spring, kilogram_per_second_squared, kilograms_per_second_squared, kgps
 
 namespace EVOL_NS {
 
-class Muscle : public BodyPart, public CanHaveAxonInputs, public ForceSource {
+//how a muscle turns its inputs into a scale for its rest length
+struct MuscleActivation {
+    enum FunctionTy {
+        FIRST_INPUT, //the first input as is, ignoring the rest (1 with no inputs)
+        SUM,         //the sum of all inputs (1 with no inputs)
+        MEAN,        //the mean of all inputs (1 with no inputs)
+        SIGMOID,     //a logistic curve of gain times the sum, spread over [minScale, maxScale]
+        FUNCTION_COUNT
+    };
+    FunctionTy function;
+//the scale is always kept within these bounds
+    Axon::OutputTy minScale, maxScale;
+//only used by SIGMOID
+    Axon::OutputTy gain;
+    MuscleActivation(FunctionTy f = FIRST_INPUT, Axon::OutputTy lo = 0.5, Axon::OutputTy hi = 1.5, Axon::OutputTy g = 1.0) :
+        function(f), minScale(lo), maxScale(hi), gain(g) {}
+//the scale given inputs first up to last, where input(e) is the value of input
+//    e; ValueTy is Axon::OutputTy, or Fixed in a deterministic world
+    template<class ValueTy, class InputFn>
+    static ValueTy apply(FunctionTy function, ValueTy lo, ValueTy hi, ValueTy gain,
+                         size_t first, size_t last, InputFn input)
+    {
+        using std::exp;
+        ValueTy ret = ValueTy(1);
+        if( function == FIRST_INPUT )
+        {
+            if( first != last ) ret = input(first);
+        }
+        else
+        {
+            ValueTy sum = ValueTy(0);
+            for(size_t e = first; e < last; ++e)
+                sum += input(e);
+            if( function == SIGMOID )
+                return lo + (hi - lo) / (ValueTy(1) + exp(-gain * sum));
+            if( first != last )
+                ret = (function == MEAN) ? sum / ValueTy(int(last - first)) : sum;
+        }
+        if( ret < lo ) ret = lo;
+        if( ret > hi ) ret = hi;
+        return ret;
+    }
+};
+
+//the batched form of Muscle::update() for count muscles with the same
+//    activation function F: the inputs of muscle i are values[indices[e]] for
+//    e from offsets[i] up to offsets[i+1], and its scale goes to scales[i].
+//    Arrays can cover the muscles of one creature or of a whole population,
+//    and hold Axon::OutputTy or (in a deterministic world) Fixed
+template<MuscleActivation::FunctionTy F, class IndexTy, class ValueTy>
+void activateMuscles(size_t count, const IndexTy* offsets, const IndexTy* indices, const ValueTy* values,
+                     const ValueTy* minScales, const ValueTy* maxScales, const ValueTy* gains,
+                     ValueTy* scales)
+{
+    for(size_t i = 0; i < count; ++i)
+    {
+        scales[i] = MuscleActivation::apply(F, minScales[i], maxScales[i], gains[i], offsets[i], offsets[i+1],
+                                            [=](size_t e) {return values[indices[e]];});
+    }
+}
+
+//pick the kernel for a function known only at run time
+template<class IndexTy, class ValueTy>
+void activateMuscles(MuscleActivation::FunctionTy function, size_t count, const IndexTy* offsets, const IndexTy* indices,
+                     const ValueTy* values, const ValueTy* minScales, const ValueTy* maxScales,
+                     const ValueTy* gains, ValueTy* scales)
+{
+    switch( function )
+    {
+    case MuscleActivation::FIRST_INPUT:
+        activateMuscles<MuscleActivation::FIRST_INPUT,IndexTy,ValueTy>(count, offsets, indices, values, minScales, maxScales, gains, scales);
+        break;
+    case MuscleActivation::SUM:
+        activateMuscles<MuscleActivation::SUM,IndexTy,ValueTy>(count, offsets, indices, values, minScales, maxScales, gains, scales);
+        break;
+    case MuscleActivation::MEAN:
+        activateMuscles<MuscleActivation::MEAN,IndexTy,ValueTy>(count, offsets, indices, values, minScales, maxScales, gains, scales);
+        break;
+    default:
+        activateMuscles<MuscleActivation::SIGMOID,IndexTy,ValueTy>(count, offsets, indices, values, minScales, maxScales, gains, scales);
+        break;
+    }
+}
+
+//the muscles in a PhysicsWorld, one array per component, with the ends given
+//    as indices into the world's NodeArrays; values are in SI units
+struct SpringArrays {
+    std::vector<uint32_t> nodeA, nodeB;
+    std::vector<double> desiredLength, rigidity;
+//the length of each spring, and the unit vector from its B end to its A
+//    end, as of the end of the last step; measured once per step and used by
+//    the force pass, sensors and tracing alike
+    std::vector<double> length, direction[MAX_DIMENSIONS];
+//springs whose desired length has changed since the world last looked, so
+//    that it can wake their ends
+    std::vector<uint32_t> changed;
+};
+
+class Muscle final : public BodyPart, public CanHaveAxonInputs, public ForceSource {
+//the world works out our forces while we are in it
+    template<unsigned Dims> friend class BasicPhysicsWorld;
 public:
     typedef PositionableObject::PositTy LengthTy;
 //spring constant is measured in Newtons/meter, or kilograms/second^2
     typedef units::spring::kilogram_per_second_squared_t RigidityTy;
 private:
-    LengthTy desiredLength;
+//the length the muscle has at a scale of 1, and the length it is pulling
+//    towards this tick
+    LengthTy restLength, desiredLength;
+    MuscleActivation activation;
 //the rigidity of a muscle is how hard it pushes/pulls on the nodes it is connected to
     RigidityTy rigidity;
 //the two ends of the muscle
     PositionableObjectPtr objectA, objectB;
 //forces applied to objectA and objectB
     Force forceA, forceB;
+//while in a world, our desired length is passed on to its arrays and the
+//    world applies our forces, rather than our ends asking us for them
+    SpringArrays* boundSprings;
+    size_t springIndex;
+//we are a force source of our ends only while not in a world
+    void addToEnds()
+    {
+        //the ends do not own us (whoever holds the muscle does), so hand them
+        //    a pointer that will never try to delete us
+        ForceSourcePtr thisptr(this, [](ForceSource*) {});
+        objectA->addForceSource(thisptr);
+        objectB->addForceSource(thisptr);
+    }
+    void removeFromEnds()
+    {
+        objectA->removeForceSource(this);
+        objectB->removeForceSource(this);
+    }
 public:
-    Muscle(RigidityTy rigid) : desiredLength(1.0), rigidity(rigid) {}
-//connect the ends of the muscle
+    Muscle(RigidityTy rigid, LengthTy rest = 1.0_m, MuscleActivation act = MuscleActivation()) :
+        restLength(rest), desiredLength(rest), activation(act), rigidity(rigid), boundSprings(nullptr), springIndex(0) {}
+//copies are never in a world, and are connected to nothing until remapped
+    Muscle(const Muscle& other) : BodyPart(other), CanHaveAxonInputs(other), ForceSource(other),
+        restLength(other.restLength), desiredLength(other.desiredLength), activation(other.activation),
+        rigidity(other.rigidity), objectA(other.objectA), objectB(other.objectB),
+        forceA(other.forceA), forceB(other.forceB), boundSprings(nullptr), springIndex(0) {}
+    RigidityTy getRigidity() const { return rigidity; }
+    bool isInWorld() const { return boundSprings != nullptr; }
+//where we are in the world's springs, if we are in one
+    size_t getWorldIndex() const { return springIndex; }
+    LengthTy getRestLength() const { return restLength; }
+//the world takes our rigidity and lengths when we are added to it (and a
+//    finalized creature's strain sensors our rest length), so these are only
+//    for a muscle that is not in one
+    void setRigidity(RigidityTy rigid) { assert(!isInWorld()); rigidity = rigid; }
+    void setRestLength(LengthTy rest) { assert(!isInWorld()); restLength = rest; desiredLength = rest; }
+    LengthTy getDesiredLength() const { return desiredLength; }
+    const MuscleActivation& getActivation() const { return activation; }
+//connect the ends of the muscle; this must happen before we are put in a world
     void connectEnds(PositionableObjectPtr a, PositionableObjectPtr b)
     {
         objectA = a;
         objectB = b;
-        ForceSourcePtr thisptr(this);
-        objectA->addForceSource(thisptr);
-        objectB->addForceSource(thisptr);
+        addToEnds();
+    }
+//false until both ends are connected; an unconnected muscle pulls on
+//    nothing, stays at its rest length and is never put in a world
+    bool isConnected() const { return objectA and objectB; }
+//after a clone, connect to the copies of our ends.  If either has no copy
+//    we are left unconnected: the original end would otherwise be handed a
+//    pointer to us that dangles once we are gone.  False if so
+    bool remapEnds(const std::map<PositionableObject*,PositionableObjectPtr>& copies)
+    {
+        if( !objectA or !objectB ) return true;
+        auto a = copies.find(objectA.get());
+        auto b = copies.find(objectB.get());
+        if( a == copies.end() or b == copies.end() )
+        {
+            objectA.reset();
+            objectB.reset();
+            return false;
+        }
+        connectEnds(a->second, b->second);
+        return true;
+    }
+    virtual void remapLinks(const std::map<BodyPart*,BodyPartPtr>&,
+                            const std::map<PositionableObject*,PositionableObjectPtr>& nodes)
+    {
+        //an end outside the copy leaves us unconnected, which isConnected()
+        //    tells whoever made the copy
+        remapEnds(nodes);
+    }
+    PositionableObjectPtr getEndA() { return objectA; }
+    PositionableObjectPtr getEndB() { return objectB; }
+//muscle length is distance between points; the world measures it for us
+    LengthTy getMuscleLength()
+    {
+        if( boundSprings ) return LengthTy(boundSprings->length[springIndex]);
+        return isConnected() ? getDistance(objectA, objectB) : restLength;
+    }
+    virtual void update(SimulationContext&)
+    {
+        //scale desiredLength based on our inputs
+        auto in = inputBegin();
+        setDesiredScale(MuscleActivation::apply(activation.function, activation.minScale, activation.maxScale, activation.gain,
+                                                0, inputEnd() - in, [=](size_t e) {return in[e]->getOutputValue();}));
     }
-//muscle length is distance between points
-    LengthTy getMuscleLength() { return getDistance(objectA, objectB); }
-    virtual void update()
+//the scale of our desired length, as worked out from our inputs
+    void setDesiredScale(Axon::OutputTy scale)
     {
-        //scale desiredLength based on the input axon (only first is considered)
-        Axon::OutputTy ret = 1.0;
-        if( inputBegin() != inputEnd() )
+        desiredLength = restLength * scale;
+        if( boundSprings and boundSprings->desiredLength[springIndex] != desiredLength() )
         {
-            ret *= (*inputBegin())->getOutputValue();
+            boundSprings->desiredLength[springIndex] = desiredLength();
+            boundSprings->changed.push_back(springIndex);
         }
-        if( ret < 0.5 ) ret = 0.5;
-        if( ret > 1.5 ) ret = 1.5;
-        //scale the actual length by the scaling to get desired length
-        //TODO: there should be some baseline length that we are working off of!
-        desiredLength = 1.0_m * ret;
     }
 //finally, commit the value we calculated
     virtual void commit()
     {
-        //update forces based on our curLength/desiredLength and rigidity
-        LengthTy difference = desiredLength - getMuscleLength();
-        //the force put on objectA will be in the direction of objectB, with a vector length proportional to half the difference times our rigidity
-        forceA = createForceInDirection(objectA->getPosX() - objectB->getPosX(), objectA->getPosY() - objectB->getPosY(), rigidity * difference / 2.0);
-        //the force put on objectB will be in the direction of objectA, with a vector length proportional to half the difference times our rigidity
-        forceB = createForceInDirection(objectB->getPosX() - objectA->getPosX(), objectB->getPosY() - objectA->getPosY(), rigidity * difference / 2.0);
+        if( boundSprings ) return; //the world works out our forces
+        if( !isConnected() ) return;
+        //update forces based on our curLength/desiredLength and rigidity; the
+        //    length and direction are worked out once for both ends
+        double delta[] = {(objectA->getPosX() - objectB->getPosX())(), (objectA->getPosY() - objectB->getPosY())(),
+                          (objectA->getPosZ() - objectB->getPosZ())()};
+        double length = vectorLength<MAX_DIMENSIONS>(delta);
+        units::force::newton_t strength = rigidity * (desiredLength - LengthTy(length)) / 2.0;
+        //the force put on objectA will be away from objectB, with a vector length proportional to half the difference times our rigidity,
+        //    and the force put on objectB the opposite
+        forceA = Force(delta[0] / length * strength, delta[1] / length * strength, delta[2] / length * strength);
+        forceB = Force(-forceA.getX(), -forceA.getY(), -forceA.getZ());
     }
 //needed for BodyPart
     virtual std::string getTypeAsString() {return "Muscle";}
+    virtual BodyPartPtr clone() {return BodyPartPtr(new Muscle(*this));}
 //needed for ForceSource
     virtual Force getForce(PositionableObject* p)
     {
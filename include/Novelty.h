@@ -0,0 +1,118 @@
+#ifndef _NOVELTY_H__
+#define _NOVELTY_H__
+
+#include "config.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include "Evaluation.h"
+#include "KdTree.h"
+#include "ThreadPool.h"
+
+namespace EVOL_NS {
+
+//the behaviours seen so far in a novelty search.  A behaviour's novelty is
+//    its mean distance to the k nearest behaviours among the archive and the
+//    rest of its own batch; the batch's behaviours that are novel enough
+//    (at least the threshold) are then kept in the archive for good
+class NoveltyArchive {
+    unsigned dims, neighbours;
+    double threshold;
+    KdTree archive;
+public:
+    NoveltyArchive(unsigned dimensions, unsigned k = 15, double addThreshold = 0.0) :
+        dims(dimensions), neighbours(k), threshold(addThreshold), archive(dimensions) {}
+    unsigned getDimensions() const {return dims;}
+    size_t size() const {return archive.size();}
+    unsigned getNeighbourCount() const {return neighbours;}
+    void setNeighbourCount(unsigned k) {neighbours = k;}
+    double getThreshold() const {return threshold;}
+    void setThreshold(double t) {threshold = t;}
+    void add(const double* behaviour) {archive.add(behaviour);}
+//the novelty of count behaviours (packed, getDimensions() values each), into
+//    novelty; searches are split across pool if given
+    void score(const double* behaviours, size_t count, double* novelty, ThreadPool* pool = nullptr) const
+    {
+        KdTree batch(dims);
+        std::vector<KdTree::IndexTy> self(count);
+        for(size_t i = 0; i < count; ++i)
+            self[i] = batch.add(behaviours + i * dims);
+        unsigned k = neighbours;
+        std::vector<KdTree::Neighbour> fromArchive(count * k), fromBatch(count * k);
+        archive.nearest(behaviours, count, k, fromArchive.data(), pool);
+        batch.nearest(behaviours, count, k, fromBatch.data(), pool, self.data());
+        //both lists are sorted, so the k nearest overall are a merge of them
+        auto combine = [&](size_t begin, size_t end, unsigned) {
+            for(size_t i = begin; i < end; ++i)
+            {
+                const KdTree::Neighbour* a = &fromArchive[i * k];
+                const KdTree::Neighbour* b = &fromBatch[i * k];
+                double sum = 0.0;
+                unsigned found = 0;
+                for(unsigned ia = 0, ib = 0; found < k; ++found)
+                {
+                    bool takeA = ib == k or (ia < k and a[ia] < b[ib]);
+                    const KdTree::Neighbour& n = takeA ? a[ia++] : b[ib++];
+                    if( n.index == KdTree::NONE ) break;
+                    sum += std::sqrt(n.distanceSquared);
+                }
+                novelty[i] = found ? sum / found : 0.0;
+            }
+        };
+        if( pool )
+            pool->parallelFor(count, combine);
+        else
+            combine(0, count, 0);
+    }
+//score a batch, then keep those at or above the threshold; returns how many were kept
+    size_t scoreAndAdd(const double* behaviours, size_t count, double* novelty, ThreadPool* pool = nullptr)
+    {
+        score(behaviours, count, novelty, pool);
+        size_t added = 0;
+        for(size_t i = 0; i < count; ++i)
+        {
+            if( novelty[i] < threshold ) continue;
+            add(behaviours + i * dims);
+            ++added;
+        }
+        return added;
+    }
+//the behaviours of a batch of evaluations, packed for score(); ones of the
+//    wrong length are cut off or padded with zeros
+    std::vector<double> pack(const std::vector<Evaluation>& results) const
+    {
+        std::vector<double> packed(results.size() * dims, 0.0);
+        for(size_t i = 0; i < results.size(); ++i)
+        {
+            const std::vector<double>& b = results[i].behaviour;
+            std::copy(b.begin(), b.begin() + std::min<size_t>(b.size(), dims), packed.begin() + i * dims);
+        }
+        return packed;
+    }
+//scoreAndAdd() on the behaviours of a batch of evaluations.  Terminated
+//    runs (stopped early or diverged) did not behave the way a full run
+//    would, so they are left out: they are not neighbours of the others, are
+//    never kept, and get a novelty of -infinity
+    std::vector<double> scoreAndAdd(const std::vector<Evaluation>& results, ThreadPool* pool = nullptr)
+    {
+        std::vector<Evaluation> finished;
+        std::vector<size_t> from;
+        for(size_t i = 0; i < results.size(); ++i)
+            if( !results[i].terminated )
+            {
+                finished.push_back(results[i]);
+                from.push_back(i);
+            }
+        std::vector<double> packed = pack(finished), scored(finished.size());
+        scoreAndAdd(packed.data(), finished.size(), scored.data(), pool);
+        std::vector<double> novelty(results.size(), -std::numeric_limits<double>::infinity());
+        for(size_t j = 0; j < from.size(); ++j)
+            novelty[from[j]] = scored[j];
+        return novelty;
+    }
+};
+
+}; //namespace EVOL_NS
+
+#endif
@@ -0,0 +1,339 @@
+#ifndef _PART_BATCHES_H__
+#define _PART_BATCHES_H__
+
+#include "config.h"
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "Axon.h"
+#include "AxonTypes.h"
+#include "BodyPart.h"
+#include "Bone.h"
+#include "Fixed.h"
+#include "Muscle.h"
+#include "PhysicsWorld.h"
+#include "SensorAxons.h"
+#include "SimulationContext.h"
+
+namespace EVOL_NS {
+
+//the finalized form of a creature's parts, grouped by kind so that a tick
+//    makes one pass over each kind rather than going through BodyPart's
+//    virtual update()/commit() (and Axon's calculateNewOutput()) once per part.
+//    Every part gets a slot, handed out kind by kind so each kind is one
+//    contiguous range; an axon's output lives in its slot of a flat value
+//    array, and all the edges between parts are kept in a single CSR table
+//    of slot indices. Parts of any other type keep their own range and are
+//    still reached through the virtual interface.
+class PartBatches {
+public:
+    typedef uint32_t SlotTy;
+private:
+//committed and newly calculated outputs, indexed by slot
+    std::vector<Axon::OutputTy> values, newValues;
+//the inputs of slot s are inputIndices[inputOffsets[s]] up to (but not
+//    including) inputIndices[inputOffsets[s+1]]
+    std::vector<SlotTy> inputOffsets;
+    std::vector<SlotTy> inputIndices;
+//where each kind's range of slots begins; the ranges are in this order and
+//    the last one (inputs from axons outside the creature) runs to the end
+    SlotTy constBegin, timeBegin, sensorBegin, addBegin, subBegin, muscleBegin, otherBegin, externalBegin;
+//copies of the const axons' values, which is why those may not be set
+//    while we are built
+    std::vector<Axon::OutputTy> constValues;
+//the sensors are sorted by quantity, and sensors of quantity q start at
+//    sensorQuantityBegin[q] (counted from the first sensor); each reads the
+//    world's arrays at sensorNodeA/B, or for muscles at sensorSprings
+    SlotTy sensorQuantityBegin[SensorAxon::QUANTITY_COUNT + 1];
+    std::vector<SlotTy> sensorNodeA, sensorNodeB, sensorSprings;
+//copied too, which holds as the muscles are in the world
+    std::vector<double> sensorRestLengths;
+//the axons whose outputs we hold, i.e. the const/time/sensor/add/sub ranges
+    std::vector<Axon*> boundAxons;
+    std::vector<Muscle*> muscles;
+//the muscles are sorted by activation function, and muscles using function f
+//    start at muscleFunctionBegin[f] (counted from the first muscle)
+    SlotTy muscleFunctionBegin[MuscleActivation::FUNCTION_COUNT + 1];
+    std::vector<Axon::OutputTy> muscleMinScales, muscleMaxScales, muscleGains, muscleScales;
+//the same in fixed point, with a copy of the values, for a deterministic world
+    std::vector<Fixed> fixedValues, fixedMinScales, fixedMaxScales, fixedGains, fixedScales;
+//the other parts, and (where they are axons) the axon to copy output from
+    std::vector<BodyPart*> others;
+    std::vector<Axon*> otherAxons;
+//axons that are inputs to our parts but not part of the creature
+    std::vector<AxonPtr> externals;
+    static bool byFunction(Muscle* a, Muscle* b)
+    {
+        return a->getActivation().function < b->getActivation().function;
+    }
+    static bool byQuantity(SensorAxon* a, SensorAxon* b)
+    {
+        return a->getQuantity() < b->getQuantity();
+    }
+//the part as a sensor that can be batched, i.e. one whose nodes are all in
+//    the world; otherwise null
+    static SensorAxon* gatherable(BodyPart* part, const PhysicsWorld& world)
+    {
+        SensorAxon* sensor = dynamic_cast<SensorAxon*>(part);
+        if( !sensor ) return nullptr;
+        PositionableObjectPtr a = sensor->getNodeA(), b = sensor->getNodeB();
+        if( !a or !world.contains(*a) ) return nullptr;
+        bool readsB = sensor->getQuantity() >= SensorAxon::MUSCLE_LENGTH;
+        if( readsB and (!b or !world.contains(*b)) ) return nullptr;
+        if( sensor->getMuscle() and !world.contains(*sensor->getMuscle()) ) return nullptr;
+        return sensor;
+    }
+    static Axon::OutputTy outputOf(Axon::OutputTy v) {return v;}
+    static Axon::OutputTy outputOf(Fixed v) {return v.toDouble();}
+//the add, sub and muscle batches, worked out in ValueTy from in (the values
+//    as ValueTy) and the muscles' activation settings
+    template<class ValueTy>
+    void combine(const ValueTy* in, const ValueTy* minScales, const ValueTy* maxScales, const ValueTy* gains, ValueTy* scales)
+    {
+        for(SlotTy s = addBegin; s < subBegin; ++s)
+        {
+            ValueTy ret = ValueTy(0);
+            for(SlotTy e = inputOffsets[s]; e < inputOffsets[s+1]; ++e)
+                ret += in[inputIndices[e]];
+            newValues[s] = outputOf(ret);
+        }
+        for(SlotTy s = subBegin; s < muscleBegin; ++s)
+        {
+            //first input is the base value, all others subtracted from it
+            ValueTy ret = ValueTy(0);
+            if( inputOffsets[s] != inputOffsets[s+1] )
+                ret = in[inputIndices[inputOffsets[s]]];
+            for(SlotTy e = inputOffsets[s] + 1; e < inputOffsets[s+1]; ++e)
+                ret -= in[inputIndices[e]];
+            newValues[s] = outputOf(ret);
+        }
+        for(int f = 0; f < MuscleActivation::FUNCTION_COUNT; ++f)
+        {
+            SlotTy first = muscleFunctionBegin[f];
+            activateMuscles(MuscleActivation::FunctionTy(f), muscleFunctionBegin[f+1] - first,
+                            inputOffsets.data() + muscleBegin + first, inputIndices.data(), in,
+                            minScales + first, maxScales + first, gains + first, scales + first);
+        }
+        for(SlotTy i = 0; i < muscles.size(); ++i)
+            muscles[i]->setDesiredScale(outputOf(scales[i]));
+    }
+    template<class KindTy>
+    static void append(std::vector<KindTy*>& kind, std::vector<BodyPart*>& order)
+    {
+        order.insert(order.end(), kind.begin(), kind.end());
+    }
+//hand the values back to the axons, so they work on their own again
+    void unbind()
+    {
+        for(SlotTy s = 0; s < boundAxons.size(); ++s)
+        {
+            boundAxons[s]->oldValue = boundAxons[s]->newValue = values[s];
+            boundAxons[s]->boundValue = nullptr;
+        }
+        boundAxons.clear();
+    }
+public:
+    PartBatches() : constBegin(0), timeBegin(0), sensorBegin(0), addBegin(0), subBegin(0), muscleBegin(0), otherBegin(0), externalBegin(0)
+    {
+        std::fill(sensorQuantityBegin, sensorQuantityBegin + SensorAxon::QUANTITY_COUNT + 1, 0);
+        std::fill(muscleFunctionBegin, muscleFunctionBegin + MuscleActivation::FUNCTION_COUNT + 1, 0);
+    }
+//batches point into the parts they were built from, so they can be moved
+//    along with them but never copied
+    PartBatches(const PartBatches&) = delete;
+    PartBatches& operator = (const PartBatches&) = delete;
+    PartBatches(PartBatches&&) = default;
+    PartBatches& operator = (PartBatches&&) = delete;
+    ~PartBatches() { unbind(); }
+//forget every part, handing values back to the axons
+    void clear()
+    {
+        unbind();
+        values.clear();
+        newValues.clear();
+        inputOffsets.clear();
+        inputIndices.clear();
+        constValues.clear();
+        sensorNodeA.clear();
+        sensorNodeB.clear();
+        sensorSprings.clear();
+        sensorRestLengths.clear();
+        muscles.clear();
+        muscleMinScales.clear();
+        muscleMaxScales.clear();
+        muscleGains.clear();
+        muscleScales.clear();
+        fixedValues.clear();
+        fixedMinScales.clear();
+        fixedMaxScales.clear();
+        fixedGains.clear();
+        fixedScales.clear();
+        others.clear();
+        otherAxons.clear();
+        externals.clear();
+        constBegin = timeBegin = sensorBegin = addBegin = subBegin = muscleBegin = otherBegin = externalBegin = 0;
+        std::fill(sensorQuantityBegin, sensorQuantityBegin + SensorAxon::QUANTITY_COUNT + 1, 0);
+        std::fill(muscleFunctionBegin, muscleFunctionBegin + MuscleActivation::FUNCTION_COUNT + 1, 0);
+    }
+//sort the parts into batches and gather their edges; sensors read from the
+//    given world.  The parts must outlive the batches, and must not gain
+//    inputs until clear() is called
+    void build(std::map<std::string,BodyPartPtr>& parts, const PhysicsWorld& world)
+    {
+        clear();
+        std::vector<ConstAxon*> consts;
+        std::vector<TimeAxon*> times;
+        std::vector<SensorAxon*> sensors;
+        std::vector<AddAxon*> adds;
+        std::vector<SubAxon*> subs;
+        for(auto BI : parts)
+        {
+            BodyPart* part = BI.second.get();
+            if( ConstAxon* c = dynamic_cast<ConstAxon*>(part) ) consts.push_back(c);
+            else if( TimeAxon* t = dynamic_cast<TimeAxon*>(part) ) times.push_back(t);
+            else if( SensorAxon* n = gatherable(part, world) ) sensors.push_back(n);
+            else if( AddAxon* a = dynamic_cast<AddAxon*>(part) ) adds.push_back(a);
+            else if( SubAxon* s = dynamic_cast<SubAxon*>(part) ) subs.push_back(s);
+            else if( Muscle* m = dynamic_cast<Muscle*>(part) ) muscles.push_back(m);
+            else if( dynamic_cast<Bone*>(part) ) continue; //nothing to do each tick
+            else others.push_back(part);
+        }
+        std::stable_sort(sensors.begin(), sensors.end(), byQuantity);
+        for(int q = 0, i = 0; q <= SensorAxon::QUANTITY_COUNT; ++q)
+        {
+            for(; i < (int)sensors.size() and sensors[i]->getQuantity() < q; ++i) {}
+            sensorQuantityBegin[q] = i;
+        }
+        for(auto sensor : sensors)
+        {
+            PositionableObjectPtr a = sensor->getNodeA(), b = sensor->getNodeB();
+            sensorNodeA.push_back(a->getWorldIndex());
+            sensorNodeB.push_back(b ? b->getWorldIndex() : 0);
+            sensorSprings.push_back(sensor->getMuscle() ? sensor->getMuscle()->getWorldIndex() : 0);
+            sensorRestLengths.push_back(sensor->getMuscle() ? sensor->getMuscle()->getRestLength()() : 1.0);
+        }
+        std::stable_sort(muscles.begin(), muscles.end(), byFunction);
+        for(int f = 0, i = 0; f <= MuscleActivation::FUNCTION_COUNT; ++f)
+        {
+            for(; i < (int)muscles.size() and muscles[i]->getActivation().function < f; ++i) {}
+            muscleFunctionBegin[f] = i;
+        }
+        for(auto musc : muscles)
+        {
+            muscleMinScales.push_back(musc->getActivation().minScale);
+            muscleMaxScales.push_back(musc->getActivation().maxScale);
+            muscleGains.push_back(musc->getActivation().gain);
+            fixedMinScales.push_back(Fixed::fromDouble(muscleMinScales.back()));
+            fixedMaxScales.push_back(Fixed::fromDouble(muscleMaxScales.back()));
+            fixedGains.push_back(Fixed::fromDouble(muscleGains.back()));
+        }
+        muscleScales.resize(muscles.size());
+        fixedScales.resize(muscles.size());
+        //hand out the slots kind by kind
+        std::vector<BodyPart*> order;
+        constBegin = order.size(); append(consts, order);
+        timeBegin = order.size(); append(times, order);
+        sensorBegin = order.size(); append(sensors, order);
+        addBegin = order.size(); append(adds, order);
+        subBegin = order.size(); append(subs, order);
+        muscleBegin = order.size(); append(muscles, order);
+        otherBegin = order.size(); append(others, order);
+        externalBegin = order.size();
+        std::map<Axon*,SlotTy> axonSlots;
+        for(SlotTy s = 0; s < order.size(); ++s)
+        {
+            if( Axon* axe = dynamic_cast<Axon*>(order[s]) )
+                axonSlots[axe] = s;
+        }
+        for(auto c : consts)
+            constValues.push_back(c->getConstValue());
+        for(auto part : others)
+            otherAxons.push_back(dynamic_cast<Axon*>(part));
+        //gather the edges, giving any input from outside the creature a slot of its own
+        inputOffsets.push_back(0);
+        for(auto part : order)
+        {
+            if( CanHaveAxonInputs* base = dynamic_cast<CanHaveAxonInputs*>(part) )
+            {
+                for(auto II = base->inputBegin(); II != base->inputEnd(); ++II)
+                {
+                    auto result = axonSlots.find(II->get());
+                    if( result == axonSlots.end() )
+                    {
+                        result = axonSlots.insert(std::make_pair(II->get(), SlotTy(externalBegin + externals.size()))).first;
+                        externals.push_back(*II);
+                    }
+                    inputIndices.push_back(result->second);
+                }
+            }
+            inputOffsets.push_back(inputIndices.size());
+        }
+        //take over the built in axons' outputs; values must not be resized after this
+        values.resize(externalBegin + externals.size(), 0.0);
+        for(SlotTy s = 0; s < order.size(); ++s)
+        {
+            if( Axon* axe = dynamic_cast<Axon*>(order[s]) )
+                values[s] = axe->getOutputValue();
+        }
+        newValues = values;
+        for(SlotTy s = constBegin; s < muscleBegin; ++s)
+        {
+            Axon* axe = static_cast<Axon*>(order[s]);
+            axe->boundValue = &values[s];
+            boundAxons.push_back(axe);
+        }
+    }
+//same two stages as BodyPart
+    void update(SimulationContext& ctx)
+    {
+        for(SlotTy s = externalBegin; s < values.size(); ++s)
+            values[s] = externals[s - externalBegin]->getOutputValue();
+        std::copy(constValues.begin(), constValues.end(), newValues.begin() + constBegin);
+        std::fill(newValues.begin() + timeBegin, newValues.begin() + sensorBegin, Axon::OutputTy(ctx.getTicks()));
+        const PhysicsWorld& world = ctx.getWorld();
+        for(int q = 0; q < SensorAxon::QUANTITY_COUNT; ++q)
+        {
+            SlotTy first = sensorQuantityBegin[q];
+            gatherSensors(SensorAxon::QuantityTy(q), sensorQuantityBegin[q+1] - first,
+                          sensorNodeA.data() + first, sensorNodeB.data() + first, sensorSprings.data() + first,
+                          sensorRestLengths.data() + first, world.getNodes(), world.getSprings(), newValues.data() + sensorBegin + first);
+        }
+        if( world.isDeterministic() )
+        {
+            //atan2 is the one sensor that libm could answer differently
+            const NodeArrays& n = world.getNodes();
+            for(SlotTy i = sensorQuantityBegin[SensorAxon::ORIENTATION]; i < sensorQuantityBegin[SensorAxon::ORIENTATION+1]; ++i)
+            {
+                SlotTy a = sensorNodeA[i], b = sensorNodeB[i];
+                newValues[sensorBegin + i] = atan2(Fixed::fromDouble(n.pos[1][b]) - Fixed::fromDouble(n.pos[1][a]),
+                                                   Fixed::fromDouble(n.pos[0][b]) - Fixed::fromDouble(n.pos[0][a])).toDouble();
+            }
+            fixedValues.resize(values.size());
+            for(SlotTy s = 0; s < values.size(); ++s)
+                fixedValues[s] = Fixed::fromDouble(values[s]);
+            combine(fixedValues.data(), fixedMinScales.data(), fixedMaxScales.data(), fixedGains.data(), fixedScales.data());
+        }
+        else
+            combine(values.data(), muscleMinScales.data(), muscleMaxScales.data(), muscleGains.data(), muscleScales.data());
+        for(auto part : others)
+            part->update(ctx);
+    }
+    void commit()
+    {
+        std::copy(newValues.begin() + constBegin, newValues.begin() + muscleBegin, values.begin() + constBegin);
+        for(auto musc : muscles)
+            musc->Muscle::commit();
+        for(SlotTy i = 0; i < others.size(); ++i)
+        {
+            others[i]->commit();
+            if( otherAxons[i] )
+                values[otherBegin + i] = otherAxons[i]->getOutputValue();
+        }
+    }
+};
+
+}; //namespace EVOL_NS
+
+#endif
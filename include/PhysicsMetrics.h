@@ -0,0 +1,49 @@
+#ifndef _PHYSICS_METRICS_H__
+#define _PHYSICS_METRICS_H__
+
+#include "config.h"
+#include <cmath>
+#include "Force.h"
+
+//momentum isn't a first class type either
+namespace units {
+UNIT_ADD(momentum, kilogram_meter_per_second, kilogram_meters_per_second, kgmps, compound_unit<mass::kilogram, velocity::meters_per_second>)
+};
+
+namespace EVOL_NS {
+
+typedef Vector<units::momentum::kilogram_meter_per_second_t> Momentum;
+
+//what a world measured over its nodes and springs at the end of its last
+//    step; values are in SI units
+struct PhysicsMetrics {
+    double kineticEnergy, springEnergy;
+    double momentum[MAX_DIMENSIONS];
+    PhysicsMetrics() {clear();}
+    void clear()
+    {
+        kineticEnergy = springEnergy = 0.0;
+        for(unsigned d = 0; d < MAX_DIMENSIONS; ++d)
+            momentum[d] = 0.0;
+    }
+    units::energy::joule_t getKineticEnergy() const {return units::energy::joule_t(kineticEnergy);}
+    units::energy::joule_t getSpringEnergy() const {return units::energy::joule_t(springEnergy);}
+    units::energy::joule_t getTotalEnergy() const {return units::energy::joule_t(kineticEnergy + springEnergy);}
+    Momentum getMomentum() const
+    {
+        typedef Momentum::UnitTy UnitTy;
+        return Momentum(UnitTy(momentum[0]), UnitTy(momentum[1]), UnitTy(momentum[2]));
+    }
+//false once anything has become infinite or NaN
+    bool isFinite() const
+    {
+        bool finite = std::isfinite(kineticEnergy) and std::isfinite(springEnergy);
+        for(unsigned d = 0; d < MAX_DIMENSIONS; ++d)
+            finite = finite and std::isfinite(momentum[d]);
+        return finite;
+    }
+};
+
+}; //namespace EVOL_NS
+
+#endif
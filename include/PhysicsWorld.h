@@ -0,0 +1,1109 @@
+#ifndef _PHYSICS_WORLD_H__
+#define _PHYSICS_WORLD_H__
+
+#include "config.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "Bone.h"
+#include "Fixed.h"
+#include "Force.h"
+#include "ForceFields.h"
+#include "Muscle.h"
+#include "PhysicsMetrics.h"
+#include "Terrain.h"
+#include "ThreadPool.h"
+
+namespace EVOL_NS {
+
+//work out the length and direction of spring s from where its ends are now
+template<unsigned Dims>
+inline void measureSpring(size_t s, SpringArrays& springs, const NodeArrays& n)
+{
+    uint32_t a = springs.nodeA[s], b = springs.nodeB[s];
+    double delta[Dims];
+    for(unsigned d = 0; d < Dims; ++d)
+        delta[d] = n.pos[d][a] - n.pos[d][b];
+    double length = vectorLength<Dims>(delta);
+    springs.length[s] = length;
+    for(unsigned d = 0; d < Dims; ++d)
+        springs.direction[d][s] = length == 0 ? 0.0 : delta[d] / length;
+}
+
+//add the force of spring s to its ends: along the line between them, with
+//    strength half the difference between desired and measured length times
+//    the rigidity, pushing the ends apart if the spring is too short.  force
+//    holds one array per component
+template<unsigned Dims>
+inline void applySpring(size_t s, const SpringArrays& springs, double* const* force)
+{
+    uint32_t a = springs.nodeA[s], b = springs.nodeB[s];
+    double length = springs.length[s];
+    if( length == 0 ) return; //no direction to push in
+    double strength = springs.rigidity[s] * (springs.desiredLength[s] - length) / 2.0;
+    for(unsigned d = 0; d < Dims; ++d)
+    {
+        double f = springs.direction[d][s] * strength;
+        force[d][a] += f;
+        force[d][b] -= f;
+    }
+}
+
+//move the ends of every bone back towards the bone's length, sharing the
+//    correction between them by inverse mass (one Gauss-Seidel sweep of
+//    position based dynamics); bones whose ends are asleep are left alone.
+//    ValueTy is double, or Fixed in a deterministic world
+template<unsigned Dims, class ValueTy>
+inline void projectBones(const BoneArrays& bones, const ValueTy* boneLength, const ValueTy* inverseMass,
+                         const unsigned char* awake, ValueTy* const* pos)
+{
+    for(size_t k = 0; k < bones.length.size(); ++k)
+    {
+        uint32_t a = bones.nodeA[k], b = bones.nodeB[k];
+        if( !awake[a] ) continue;
+        ValueTy wsum = inverseMass[a] + inverseMass[b];
+        ValueTy delta[Dims];
+        for(unsigned d = 0; d < Dims; ++d)
+            delta[d] = pos[d][a] - pos[d][b];
+        ValueTy length = vectorLength<Dims>(delta);
+        if( length == ValueTy(0) or wsum == ValueTy(0) ) continue;
+        ValueTy correction = (length - boneLength[k]) / (length * wsum);
+        for(unsigned d = 0; d < Dims; ++d)
+        {
+            pos[d][a] -= inverseMass[a] * correction * delta[d];
+            pos[d][b] += inverseMass[b] * correction * delta[d];
+        }
+    }
+}
+
+//the set of objects that are moved by the physics of one simulation; their
+//    state is kept here in NodeArrays, and each object reads its own entry.
+//    Muscles between objects in the world become springs in SpringArrays,
+//    and their forces are applied here in one pass, followed by the world's
+//    force fields (gravity, drag) and the terrain's push on nodes below it.
+//    Bones are constraints
+//    rather than forces: after the usual step, their ends are projected back
+//    to the bones' lengths, and the nodes' velocities set from how far they
+//    really moved.  Nodes joined by muscles or bones form an island; when
+//    sleeping is turned on, an island that stays still long enough is put to
+//    sleep and skipped until something disturbs it.
+//    Dims is 2 (x, and y up) or 3 (adding z); PhysicsWorld is the one picked
+//    by EVOL_DIMENSIONS, which the rest of the simulation uses.
+//    A deterministic world steps in fixed point, giving the same bits on any
+//    machine and with any number of threads
+template<unsigned Dims>
+class BasicPhysicsWorld {
+    static_assert(Dims == 2 or Dims == 3, "worlds are 2D or 3D");
+public:
+//how the spring pass adds forces onto the nodes
+    enum SpringPassTy {
+        SERIAL,    //one thread, in the order springs were added
+        COLORED,   //springs are colored so no two of a color share a node, and
+                   //    each color is applied in parallel without atomics
+        BUFFERED,  //each thread adds its share of the springs into its own
+                   //    buffer, and the buffers are then summed per node
+        AUTOMATIC  //COLORED, unless there are too many colors to keep every
+                   //    thread busy (a few nodes with many springs), then BUFFERED
+    };
+private:
+    std::vector<PositionableObjectPtr> objects;
+    std::vector<MusclePtr> muscles;
+    std::vector<BonePtr> boneParts;
+//held by pointer so that objects can keep pointing at them when we are moved
+    std::unique_ptr<NodeArrays> nodes;
+    std::unique_ptr<SpringArrays> springs;
+    BoneArrays bones;
+//the nodes at either end of any bone, their positions at the start of the
+//    step, and 1/mass for every node
+    std::vector<uint32_t> boneNodes;
+    std::vector<unsigned char> isBoneNode;
+    std::vector<double> boneStart[Dims], inverseMass;
+    int boneIterations;
+//without a terrain the ground is flat at groundLevel and doesn't push back;
+//    contact only records which nodes are at or below it
+    PositionableObject::PositTy groundLevel;
+    TerrainPtr terrain;
+    ContactModel contactModel;
+    ForceFields fields;
+//islands, worked out again whenever the world gains a node, muscle or bone.
+//    An island falls asleep once its kinetic energy has been below
+//    sleepEnergy for sleepTicks updates in a row (0 turns sleeping off)
+    std::vector<uint32_t> islandOf;
+    std::vector<int> islandCalm;
+    std::vector<double> islandEnergy, islandMass, islandForce[Dims];
+    std::vector<unsigned char> islandAsleep, islandWaking;
+    bool islandsValid;
+    double sleepEnergy;
+    int sleepTicks;
+//per node, 0 while its island sleeps
+    std::vector<unsigned char> awake;
+//adaptive stepping: each update covers tickLength seconds in steps between
+//    minStep and maxStep long, keeping the estimated error of each step in
+//    position under tolerance meters.  step is the length to try next
+    bool adaptive;
+    double tickLength, tolerance, minStep, maxStep, step;
+    size_t stepCount, rejectedCount;
+    std::vector<double> savedPos[Dims], savedVel[Dims], savedForce[Dims];
+//what else a step that is thrown away may have changed: contacts, and
+//    islands woken by the forces at its end
+    std::vector<unsigned char> savedContact, savedAwake, savedIslandAsleep, savedIslandWaking;
+    std::vector<int> savedIslandCalm;
+//springs of color c are colorOrder[colorBegin[c]] up to colorOrder[colorBegin[c+1]]
+    std::vector<uint32_t> colorOrder;
+    std::vector<size_t> colorBegin;
+    bool coloringValid;
+//parallel spring passes; no pool means everything runs on the calling thread
+    ThreadPool* pool;
+    SpringPassTy springPass;
+    size_t parallelThreshold;
+    std::vector<std::vector<double>> threadForce[Dims];
+//deterministic mode keeps the state of nodes and springs in Fixed as well,
+//    and moves it with integer arithmetic only; the double arrays are then
+//    rounded copies for everyone else to read.  The fixed state is taken from
+//    the doubles again whenever the world gains something (fixedValid false)
+    bool deterministic, fixedValid;
+    std::vector<Fixed> fixedPos[Dims], fixedVel[Dims], fixedForce[Dims], fixedInverseMass;
+    std::vector<Fixed> fixedLength, fixedDirection[Dims], fixedRigidity, fixedBoneLength, fixedBoneStart[Dims];
+    std::vector<std::vector<Fixed>> threadFixedForce[Dims];
+//with measuring on, every step also sums up its kinetic and spring energy
+//    and momentum on the way through, into metrics.  A world whose energy
+//    passes divergenceEnergy (if not 0), or stops being finite, has diverged
+//    and no longer moves
+    bool measuring, diverged;
+    PhysicsMetrics metrics;
+    double divergenceEnergy;
+    std::vector<double> threadEnergy;
+//greedy edge coloring: each spring takes the lowest color not yet used at
+//    either of its ends, which needs at most 2*(most springs at a node)-1 colors
+    void colorSprings()
+    {
+        size_t count = springs->nodeA.size();
+        std::vector<std::vector<unsigned char>> used(nodes->size());
+        std::vector<uint32_t> colors(count);
+        size_t colorCount = 0;
+        for(size_t s = 0; s < count; ++s)
+        {
+            std::vector<unsigned char>& usedA = used[springs->nodeA[s]];
+            std::vector<unsigned char>& usedB = used[springs->nodeB[s]];
+            uint32_t c = 0;
+            while( (c < usedA.size() and usedA[c]) or (c < usedB.size() and usedB[c]) ) ++c;
+            for(auto usedAt : {&usedA, &usedB})
+            {
+                if( usedAt->size() <= c ) usedAt->resize(c + 1, 0);
+                (*usedAt)[c] = 1;
+            }
+            colors[s] = c;
+            if( c + 1 > colorCount ) colorCount = c + 1;
+        }
+        //counting sort of the springs by color
+        colorBegin.assign(colorCount + 1, 0);
+        for(size_t s = 0; s < count; ++s)
+            ++colorBegin[colors[s] + 1];
+        for(size_t c = 0; c < colorCount; ++c)
+            colorBegin[c + 1] += colorBegin[c];
+        colorOrder.resize(count);
+        std::vector<size_t> next(colorBegin.begin(), colorBegin.end() - 1);
+        for(size_t s = 0; s < count; ++s)
+            colorOrder[next[colors[s]]++] = s;
+        coloringValid = true;
+    }
+    SpringPassTy choosePass()
+    {
+        size_t count = springs->nodeA.size();
+        if( springPass == SERIAL or !pool or pool->getThreadCount() < 2 or count < parallelThreshold )
+            return SERIAL;
+        if( springPass == BUFFERED )
+            return BUFFERED;
+        if( !coloringValid )
+            colorSprings();
+        if( springPass == COLORED )
+            return COLORED;
+        //a color too small to give every thread a decent share costs a whole
+        //    synchronization for little work
+        size_t colorCount = colorBegin.size() - 1;
+        return count / colorCount >= pool->getThreadCount() * 256 ? COLORED : BUFFERED;
+    }
+    void applySprings()
+    {
+        const SpringArrays& sp = *springs;
+        NodeArrays& n = *nodes;
+        double* force[Dims];
+        for(unsigned d = 0; d < Dims; ++d)
+            force[d] = n.force[d].data();
+        switch( choosePass() )
+        {
+        case SERIAL:
+            for(size_t s = 0; s < sp.nodeA.size(); ++s)
+                if( awake[sp.nodeA[s]] )
+                    applySpring<Dims>(s, sp, force);
+            break;
+        case COLORED:
+            for(size_t c = 0; c + 1 < colorBegin.size(); ++c)
+            {
+                const uint32_t* order = colorOrder.data() + colorBegin[c];
+                pool->parallelFor(colorBegin[c+1] - colorBegin[c], [&](size_t begin, size_t end, unsigned) {
+                    for(size_t i = begin; i < end; ++i)
+                        if( awake[sp.nodeA[order[i]]] )
+                            applySpring<Dims>(order[i], sp, force);
+                });
+            }
+            break;
+        default:
+        {
+            unsigned threads = pool->getThreadCount();
+            size_t nodeCount = n.size();
+            for(unsigned d = 0; d < Dims; ++d)
+                threadForce[d].resize(threads);
+            pool->parallelFor(sp.nodeA.size(), [&](size_t begin, size_t end, unsigned thread) {
+                double* buffer[Dims];
+                for(unsigned d = 0; d < Dims; ++d)
+                {
+                    threadForce[d][thread].assign(nodeCount, 0.0);
+                    buffer[d] = threadForce[d][thread].data();
+                }
+                for(size_t s = begin; s < end; ++s)
+                    if( awake[sp.nodeA[s]] )
+                        applySpring<Dims>(s, sp, buffer);
+            });
+            size_t springCount = sp.nodeA.size();
+            pool->parallelFor(nodeCount, [&](size_t begin, size_t end, unsigned) {
+                for(unsigned t = 0; t < threads; ++t)
+                {
+                    //a thread given no springs never cleared its buffer
+                    if( springCount * (t + 1) / threads == springCount * t / threads ) continue;
+                    for(unsigned d = 0; d < Dims; ++d)
+                        for(size_t i = begin; i < end; ++i)
+                            force[d][i] += threadForce[d][t][i];
+                }
+            });
+            break;
+        }
+        }
+    }
+//measure every spring whose ends can have moved, in parallel when there
+//    are enough of them; each spring only writes its own entries
+    void measureSprings()
+    {
+        SpringArrays& sp = *springs;
+        const NodeArrays& n = *nodes;
+        bool parallel = pool and springPass != SERIAL and pool->getThreadCount() > 1 and sp.nodeA.size() >= parallelThreshold;
+        threadEnergy.assign(parallel ? pool->getThreadCount() : 1, 0.0);
+        auto measure = [&](size_t begin, size_t end, unsigned thread) {
+            for(size_t s = begin; s < end; ++s)
+                if( awake[sp.nodeA[s]] )
+                    measureSpring<Dims>(s, sp, n);
+            if( measuring )
+                threadEnergy[thread] = springEnergy(begin, end);
+        };
+        if( parallel )
+            pool->parallelFor(sp.nodeA.size(), measure);
+        else
+            measure(0, sp.nodeA.size(), 0);
+        if( measuring )
+            sumSpringEnergy();
+    }
+//the potential energy of springs begin up to end, as measured; the force
+//    k (L0 - L) / 2 on each end comes from k (L - L0)^2 / 4
+    double springEnergy(size_t begin, size_t end) const
+    {
+        const SpringArrays& sp = *springs;
+        double energy = 0.0;
+        for(size_t s = begin; s < end; ++s)
+        {
+            double stretch = sp.length[s] - sp.desiredLength[s];
+            energy += sp.rigidity[s] * stretch * stretch / 4;
+        }
+        return energy;
+    }
+    void sumSpringEnergy()
+    {
+        metrics.springEnergy = 0.0;
+        for(double part : threadEnergy)
+            metrics.springEnergy += part;
+    }
+//the fixed point forms of measureSpring() and applySpring(), which also
+//    keep the double copy of the measurement
+    void measureSpringFixed(size_t s)
+    {
+        SpringArrays& sp = *springs;
+        uint32_t a = sp.nodeA[s], b = sp.nodeB[s];
+        Fixed delta[Dims];
+        for(unsigned d = 0; d < Dims; ++d)
+            delta[d] = fixedPos[d][a] - fixedPos[d][b];
+        Fixed length = vectorLength<Dims>(delta);
+        fixedLength[s] = length;
+        sp.length[s] = length.toDouble();
+        for(unsigned d = 0; d < Dims; ++d)
+        {
+            fixedDirection[d][s] = length == Fixed() ? Fixed() : delta[d] / length;
+            sp.direction[d][s] = fixedDirection[d][s].toDouble();
+        }
+    }
+    void applySpringFixed(size_t s, Fixed* const* force) const
+    {
+        const SpringArrays& sp = *springs;
+        uint32_t a = sp.nodeA[s], b = sp.nodeB[s];
+        Fixed length = fixedLength[s];
+        if( length == Fixed() ) return;
+        Fixed strength = fixedRigidity[s] * (Fixed::fromDouble(sp.desiredLength[s]) - length) / Fixed(2);
+        for(unsigned d = 0; d < Dims; ++d)
+        {
+            Fixed f = fixedDirection[d][s] * strength;
+            force[d][a] += f;
+            force[d][b] -= f;
+        }
+    }
+//fixed point sums come out the same in any order, so the parallel pass
+//    is always the buffered one, and gives the same forces as the serial one
+    void applySpringsFixed()
+    {
+        const SpringArrays& sp = *springs;
+        size_t count = sp.nodeA.size(), nodeCount = objects.size();
+        Fixed* force[Dims];
+        for(unsigned d = 0; d < Dims; ++d)
+            force[d] = fixedForce[d].data();
+        if( choosePass() == SERIAL )
+        {
+            for(size_t s = 0; s < count; ++s)
+                if( awake[sp.nodeA[s]] )
+                    applySpringFixed(s, force);
+            return;
+        }
+        unsigned threads = pool->getThreadCount();
+        for(unsigned d = 0; d < Dims; ++d)
+            threadFixedForce[d].resize(threads);
+        pool->parallelFor(count, [&](size_t begin, size_t end, unsigned thread) {
+            Fixed* buffer[Dims];
+            for(unsigned d = 0; d < Dims; ++d)
+            {
+                threadFixedForce[d][thread].assign(nodeCount, Fixed());
+                buffer[d] = threadFixedForce[d][thread].data();
+            }
+            for(size_t s = begin; s < end; ++s)
+                if( awake[sp.nodeA[s]] )
+                    applySpringFixed(s, buffer);
+        });
+        pool->parallelFor(nodeCount, [&](size_t begin, size_t end, unsigned) {
+            for(unsigned t = 0; t < threads; ++t)
+            {
+                if( count * (t + 1) / threads == count * t / threads ) continue;
+                for(unsigned d = 0; d < Dims; ++d)
+                    for(size_t i = begin; i < end; ++i)
+                        force[d][i] += threadFixedForce[d][t][i];
+            }
+        });
+    }
+//take the fixed state from the doubles, and round the doubles to match it
+    void fixState()
+    {
+        NodeArrays& n = *nodes;
+        size_t count = objects.size();
+        for(unsigned d = 0; d < Dims; ++d)
+        {
+            fixedPos[d].resize(count);
+            fixedVel[d].resize(count);
+            fixedForce[d].resize(count);
+            fixedDirection[d].resize(springs->nodeA.size());
+            fixedBoneStart[d].resize(boneNodes.size());
+            for(size_t i = 0; i < count; ++i)
+            {
+                fixedPos[d][i] = Fixed::fromDouble(n.pos[d][i]);
+                fixedVel[d][i] = Fixed::fromDouble(n.vel[d][i]);
+                n.pos[d][i] = fixedPos[d][i].toDouble();
+                n.vel[d][i] = fixedVel[d][i].toDouble();
+            }
+        }
+        fixedInverseMass.resize(count);
+        for(size_t i = 0; i < count; ++i)
+            fixedInverseMass[i] = Fixed::fromDouble(inverseMass[i]);
+        fixedLength.resize(springs->nodeA.size());
+        fixedRigidity.resize(springs->nodeA.size());
+        for(size_t s = 0; s < springs->nodeA.size(); ++s)
+        {
+            fixedRigidity[s] = Fixed::fromDouble(springs->rigidity[s]);
+            measureSpringFixed(s);
+        }
+        fixedBoneLength.resize(bones.length.size());
+        for(size_t k = 0; k < bones.length.size(); ++k)
+            fixedBoneLength[k] = Fixed::fromDouble(bones.length[k]);
+        updateContacts();
+        fixedValid = true;
+    }
+    void updateContacts()
+    {
+        NodeArrays& n = *nodes;
+        for(size_t i = 0; i < n.size(); ++i)
+            n.contact[i] = n.pos[1][i] <= groundHeight(n.pos[0][i], n.pos[2][i]);
+    }
+//a 2D world is the z = 0 slice of a terrain
+    double groundHeight(double x, double z) const {return terrain ? terrain->getHeight(x, Dims > 2 ? z : 0.0) : groundLevel();}
+//union-find over the muscles and bones; every island starts awake
+    void findIslands()
+    {
+        size_t count = objects.size();
+        std::vector<uint32_t> parent(count);
+        for(size_t i = 0; i < count; ++i)
+            parent[i] = i;
+        auto root = [&](uint32_t i) {
+            while( parent[i] != i )
+                i = parent[i] = parent[parent[i]];
+            return i;
+        };
+        auto join = [&](const std::vector<uint32_t>& a, const std::vector<uint32_t>& b) {
+            for(size_t k = 0; k < a.size(); ++k)
+                parent[root(a[k])] = root(b[k]);
+        };
+        join(springs->nodeA, springs->nodeB);
+        join(bones.nodeA, bones.nodeB);
+        std::vector<uint32_t> number(count, uint32_t(-1));
+        uint32_t islands = 0;
+        islandOf.resize(count);
+        for(size_t i = 0; i < count; ++i)
+        {
+            uint32_t r = root(i);
+            if( number[r] == uint32_t(-1) ) number[r] = islands++;
+            islandOf[i] = number[r];
+        }
+        islandCalm.assign(islands, 0);
+        islandEnergy.assign(islands, 0.0);
+        islandAsleep.assign(islands, 0);
+        islandWaking.assign(islands, 0);
+        awake.assign(count, 1);
+        islandsValid = true;
+    }
+    void wakeIsland(uint32_t island)
+    {
+        if( islandAsleep[island] ) islandWaking[island] = 1;
+    }
+//wake every island marked by wakeIsland()
+    void applyWaking()
+    {
+        bool any = false;
+        for(size_t k = 0; k < islandWaking.size(); ++k)
+        {
+            if( !islandWaking[k] ) continue;
+            islandWaking[k] = islandAsleep[k] = 0;
+            islandCalm[k] = 0;
+            any = true;
+        }
+        if( !any ) return;
+        for(size_t i = 0; i < awake.size(); ++i)
+            awake[i] = !islandAsleep[islandOf[i]];
+    }
+//put to sleep the islands that have been still for long enough
+    void settleIslands()
+    {
+        NodeArrays& n = *nodes;
+        std::fill(islandEnergy.begin(), islandEnergy.end(), 0.0);
+        for(size_t i = 0; i < awake.size(); ++i)
+            if( awake[i] )
+            {
+                double speedSquared = 0.0;
+                for(unsigned d = 0; d < Dims; ++d)
+                    speedSquared += n.vel[d][i] * n.vel[d][i];
+                islandEnergy[islandOf[i]] += n.mass[i] * speedSquared / 2;
+            }
+        bool any = false;
+        for(size_t k = 0; k < islandEnergy.size(); ++k)
+        {
+            if( islandAsleep[k] ) continue;
+            islandCalm[k] = islandEnergy[k] < sleepEnergy ? islandCalm[k] + 1 : 0;
+            if( islandCalm[k] >= sleepTicks )
+            {
+                islandAsleep[k] = 1;
+                any = true;
+            }
+        }
+        if( !any ) return;
+        for(size_t i = 0; i < awake.size(); ++i)
+        {
+            if( awake[i] and islandAsleep[islandOf[i]] )
+            {
+                awake[i] = 0;
+                for(unsigned d = 0; d < Dims; ++d)
+                    n.vel[d][i] = 0.0;
+                if( deterministic )
+                    for(unsigned d = 0; d < Dims; ++d)
+                        fixedVel[d][i] = Fixed();
+            }
+        }
+    }
+//the world has gained something: the islands and fixed state are worked
+//    out again before the next step, and finding the islands wakes them all
+    void invalidateIslands()
+    {
+        islandsValid = false;
+        fixedValid = false;
+    }
+    void wakeAll()
+    {
+        invalidateIslands();
+        awake.assign(objects.size(), 1);
+    }
+//every force on the nodes at their current state
+    void computeForces()
+    {
+        NodeArrays& n = *nodes;
+        size_t count = objects.size();
+        bool sleeping = sleepTicks > 0;
+        for(size_t i = 0; i < count; ++i)
+        {
+            if( objects[i]->hasForceSources() )
+            {
+                Force total = objects[i]->getTotalForce();
+                bool pushed = false;
+                for(unsigned d = 0; d < Dims; ++d)
+                {
+                    n.force[d][i] = total.get(d)();
+                    pushed = pushed or n.force[d][i] != 0;
+                }
+                if( sleeping and !awake[i] and pushed )
+                    wakeIsland(islandOf[i]);
+            }
+            else
+            {
+                for(unsigned d = 0; d < Dims; ++d)
+                    n.force[d][i] = 0.0;
+            }
+        }
+        if( sleeping )
+            applyWaking();
+        if( deterministic )
+        {
+            //fields and contacts act on each node alone, using nothing but
+            //    IEEE operations on the rounded state, so they are the same
+            //    everywhere when worked out in double; only then is the sum fixed
+            applyFieldsAndContacts();
+            for(unsigned d = 0; d < Dims; ++d)
+                for(size_t i = 0; i < count; ++i)
+                    fixedForce[d][i] = Fixed::fromDouble(n.force[d][i]);
+            applySpringsFixed();
+            for(unsigned d = 0; d < Dims; ++d)
+                for(size_t i = 0; i < count; ++i)
+                    n.force[d][i] = fixedForce[d][i].toDouble();
+            return;
+        }
+        applySprings();
+        applyFieldsAndContacts();
+    }
+    void applyFieldsAndContacts()
+    {
+        if( !fields.isEmpty() )
+            fields.apply<Dims>(*nodes);
+        if( terrain )
+            applyContacts<Dims>(*terrain, contactModel, *nodes);
+        if( sleepTicks > 0 )
+            wakePushedIslands();
+    }
+//wake, from the next update on, the sleeping islands that the fields and
+//    the ground would get moving: those that from rest would gather more than
+//    sleepEnergy within sleepTicks updates under the force on them now, so
+//    could not have fallen asleep under it (an island lifted off the ground,
+//    say, or one a stronger wind now blows on).  Their own springs are not
+//    worked out while they sleep, and would cancel out anyway
+    void wakePushedIslands()
+    {
+        if( std::find(islandAsleep.begin(), islandAsleep.end(), 1) == islandAsleep.end() ) return;
+        NodeArrays& n = *nodes;
+        islandMass.assign(islandAsleep.size(), 0.0);
+        for(unsigned d = 0; d < Dims; ++d)
+            islandForce[d].assign(islandAsleep.size(), 0.0);
+        for(size_t i = 0; i < awake.size(); ++i)
+        {
+            if( awake[i] ) continue;
+            islandMass[islandOf[i]] += n.mass[i];
+            for(unsigned d = 0; d < Dims; ++d)
+                islandForce[d][islandOf[i]] += n.force[d][i];
+        }
+        double time = sleepTicks * getTickLength()();
+        for(size_t k = 0; k < islandAsleep.size(); ++k)
+        {
+            if( !islandAsleep[k] ) continue;
+            double forceSquared = 0.0;
+            for(unsigned d = 0; d < Dims; ++d)
+                forceSquared += islandForce[d][k] * islandForce[d][k];
+            //the kinetic energy of the whole island, moving as one under the force
+            if( forceSquared * time * time / (2 * islandMass[k]) > sleepEnergy )
+                wakeIsland(k);
+        }
+    }
+//move every awake node by dt under its force, one component at a time so
+//    each loop runs straight down its arrays; when Measure, the momentum and
+//    kinetic energy are summed in the same loop
+    template<bool Measure>
+    void integrate(double dt)
+    {
+        NodeArrays& n = *nodes;
+        size_t count = objects.size();
+        const unsigned char* active = awake.data();
+        const double* mass = n.mass.data();
+        metrics.kineticEnergy = 0.0;
+        for(unsigned d = 0; d < Dims; ++d)
+        {
+            double* pos = n.pos[d].data();
+            double* vel = n.vel[d].data();
+            const double* force = n.force[d].data();
+            double momentum = 0.0, twiceKinetic = 0.0;
+            for(size_t i = 0; i < count; ++i)
+            {
+                if( !active[i] ) continue;
+                //F=M*A, dV = A*t, dP = V*t
+                vel[i] += force[i] / mass[i] * dt;
+                pos[i] += vel[i] * dt;
+                if( Measure )
+                {
+                    momentum += mass[i] * vel[i];
+                    twiceKinetic += mass[i] * vel[i] * vel[i];
+                }
+            }
+            metrics.momentum[d] = momentum;
+            metrics.kineticEnergy += twiceKinetic / 2;
+        }
+    }
+//one step of dt under the forces already worked out
+    void moveNodes(double dt)
+    {
+        NodeArrays& n = *nodes;
+        for(unsigned d = 0; d < Dims; ++d)
+            for(size_t k = 0; k < boneNodes.size(); ++k)
+                boneStart[d][k] = n.pos[d][boneNodes[k]];
+        const unsigned char* active = awake.data();
+        if( measuring )
+            integrate<true>(dt);
+        else
+            integrate<false>(dt);
+        if( !boneNodes.empty() )
+        {
+            double* pos[Dims];
+            for(unsigned d = 0; d < Dims; ++d)
+                pos[d] = n.pos[d].data();
+            for(int it = 0; it < boneIterations; ++it)
+                projectBones<Dims>(bones, bones.length.data(), inverseMass.data(), active, pos);
+            for(size_t k = 0; k < boneNodes.size(); ++k)
+            {
+                uint32_t i = boneNodes[k];
+                if( !active[i] ) continue;
+                for(unsigned d = 0; d < Dims; ++d)
+                {
+                    double before = n.vel[d][i];
+                    n.vel[d][i] = (n.pos[d][i] - boneStart[d][k]) / dt;
+                    //the sums saw the velocity from before the projection
+                    if( measuring )
+                    {
+                        metrics.momentum[d] += n.mass[i] * (n.vel[d][i] - before);
+                        metrics.kineticEnergy += n.mass[i] * (n.vel[d][i] * n.vel[d][i] - before * before) / 2;
+                    }
+                }
+            }
+        }
+        measureSprings();
+        updateContacts();
+    }
+//moveNodes() in fixed point, always a step of TIME_RATE
+    void moveNodesFixed()
+    {
+        NodeArrays& n = *nodes;
+        size_t count = objects.size();
+        Fixed dt = Fixed::fromDouble(TIME_RATE());
+        for(unsigned d = 0; d < Dims; ++d)
+            for(size_t k = 0; k < boneNodes.size(); ++k)
+                fixedBoneStart[d][k] = fixedPos[d][boneNodes[k]];
+        const unsigned char* active = awake.data();
+        for(unsigned d = 0; d < Dims; ++d)
+        {
+            Fixed* pos = fixedPos[d].data();
+            Fixed* vel = fixedVel[d].data();
+            const Fixed* force = fixedForce[d].data();
+            for(size_t i = 0; i < count; ++i)
+            {
+                if( !active[i] ) continue;
+                vel[i] += force[i] * fixedInverseMass[i] * dt;
+                pos[i] += vel[i] * dt;
+            }
+        }
+        if( !boneNodes.empty() )
+        {
+            Fixed* pos[Dims];
+            for(unsigned d = 0; d < Dims; ++d)
+                pos[d] = fixedPos[d].data();
+            for(int it = 0; it < boneIterations; ++it)
+                projectBones<Dims>(bones, fixedBoneLength.data(), fixedInverseMass.data(), active, pos);
+            for(size_t k = 0; k < boneNodes.size(); ++k)
+            {
+                uint32_t i = boneNodes[k];
+                if( !active[i] ) continue;
+                for(unsigned d = 0; d < Dims; ++d)
+                    fixedVel[d][i] = (fixedPos[d][i] - fixedBoneStart[d][k]) / dt;
+            }
+        }
+        metrics.kineticEnergy = 0.0;
+        for(unsigned d = 0; d < Dims; ++d)
+        {
+            double momentum = 0.0, twiceKinetic = 0.0;
+            for(size_t i = 0; i < count; ++i)
+            {
+                n.pos[d][i] = fixedPos[d][i].toDouble();
+                n.vel[d][i] = fixedVel[d][i].toDouble();
+                if( measuring )
+                {
+                    momentum += n.mass[i] * n.vel[d][i];
+                    twiceKinetic += n.mass[i] * n.vel[d][i] * n.vel[d][i];
+                }
+            }
+            metrics.momentum[d] = momentum;
+            metrics.kineticEnergy += twiceKinetic / 2;
+        }
+        for(size_t s = 0; s < springs->nodeA.size(); ++s)
+            if( awake[springs->nodeA[s]] )
+                measureSpringFixed(s);
+        if( measuring )
+            metrics.springEnergy = springEnergy(0, springs->nodeA.size());
+        updateContacts();
+    }
+//cover one tick in steps of varying length.  Each step is checked against
+//    the second order (trapezoidal) step embedded in it: the two differ in
+//    position by (change in acceleration) * h^2 / 2, which must stay under
+//    the tolerance or the step is undone and tried again shorter.  The forces
+//    at the end of an accepted step are those the next step starts from
+    void stepAdaptively()
+    {
+        NodeArrays& n = *nodes;
+        size_t count = objects.size();
+        bool sleeping = sleepTicks > 0;
+        double remaining = tickLength;
+        while( remaining > 0 )
+        {
+            double h = std::min(step, remaining);
+            for(unsigned d = 0; d < Dims; ++d)
+            {
+                savedPos[d] = n.pos[d];
+                savedVel[d] = n.vel[d];
+                savedForce[d] = n.force[d];
+            }
+            savedContact = n.contact;
+            if( sleeping )
+            {
+                savedAwake = awake;
+                savedIslandAsleep = islandAsleep;
+                savedIslandCalm = islandCalm;
+                savedIslandWaking = islandWaking;
+            }
+            moveNodes(h);
+            computeForces();
+            double worst = 0.0;
+            for(size_t i = 0; i < count; ++i)
+            {
+                if( !awake[i] ) continue;
+                double change = 0.0;
+                for(unsigned d = 0; d < Dims; ++d)
+                {
+                    double a = (n.force[d][i] - savedForce[d][i]) / n.mass[i];
+                    change += a * a;
+                }
+                worst = std::max(worst, change);
+            }
+            double error = std::sqrt(worst) * h * h / 2;
+            //grow or shrink by how far inside or outside the tolerance we
+            //    are, with some safety and limits on how fast
+            double scale = error > 0 ? 0.9 * std::sqrt(tolerance / error) : 5.0;
+            if( error > tolerance and h > minStep )
+            {
+                for(unsigned d = 0; d < Dims; ++d)
+                {
+                    n.pos[d].swap(savedPos[d]);
+                    n.vel[d].swap(savedVel[d]);
+                    n.force[d].swap(savedForce[d]);
+                }
+                n.contact.swap(savedContact);
+                if( sleeping )
+                {
+                    awake.swap(savedAwake);
+                    islandAsleep.swap(savedIslandAsleep);
+                    islandCalm.swap(savedIslandCalm);
+                    islandWaking.swap(savedIslandWaking);
+                }
+                measureSprings();
+                step = std::max(minStep, h * std::max(0.2, scale));
+                ++rejectedCount;
+                continue;
+            }
+            remaining -= h;
+            ++stepCount;
+            //a step cut short to end the tick says nothing about the next one
+            if( h == step )
+                step = std::min(maxStep, std::max(minStep, h * std::min(5.0, scale)));
+        }
+    }
+public:
+    BasicPhysicsWorld() : nodes(new NodeArrays), springs(new SpringArrays), boneIterations(4), groundLevel(0.0),
+        islandsValid(false), sleepEnergy(0.0), sleepTicks(0),
+        adaptive(false), tickLength(TIME_RATE()), tolerance(0.0), minStep(TIME_RATE()), maxStep(TIME_RATE()), step(TIME_RATE()),
+        stepCount(0), rejectedCount(0),
+        coloringValid(false), pool(nullptr), springPass(AUTOMATIC), parallelThreshold(4096),
+        deterministic(false), fixedValid(false), measuring(false), diverged(false), divergenceEnergy(0.0) {}
+//objects point into our arrays, so we can be moved but not copied
+    BasicPhysicsWorld(const BasicPhysicsWorld&) = delete;
+    BasicPhysicsWorld& operator = (const BasicPhysicsWorld&) = delete;
+    BasicPhysicsWorld(BasicPhysicsWorld&&) = default;
+//hand every object and muscle its state back
+    ~BasicPhysicsWorld()
+    {
+        for(auto musc : muscles)
+        {
+            musc->boundSprings = nullptr;
+            musc->addToEnds();
+        }
+        for(auto obj : objects)
+        {
+            obj->posx = obj->getPosX();
+            obj->posy = obj->getPosY();
+            obj->posz = obj->getPosZ();
+            obj->vx = obj->getVelX();
+            obj->vy = obj->getVelY();
+            obj->vz = obj->getVelZ();
+            obj->boundArrays = nullptr;
+        }
+    }
+//take over an object's state; its mass is read once, here.  Returns the
+//    object's index in the node arrays
+    size_t add(PositionableObjectPtr obj)
+    {
+        size_t index = objects.size();
+        objects.push_back(obj);
+        PositionableObject::PositTy pos[] = {obj->getPosX(), obj->getPosY(), obj->getPosZ()};
+        PositionableObject::VelocityTy vel[] = {obj->getVelX(), obj->getVelY(), obj->getVelZ()};
+        for(unsigned d = 0; d < MAX_DIMENSIONS; ++d)
+        {
+            nodes->pos[d].push_back(pos[d]());
+            nodes->vel[d].push_back(vel[d]());
+            nodes->force[d].push_back(0.0);
+        }
+        nodes->mass.push_back(units::mass::kilogram_t(obj->getMass())());
+        nodes->contact.push_back(pos[1]() <= groundHeight(pos[0](), pos[2]()));
+        inverseMass.push_back(1.0 / nodes->mass.back());
+        //the islands are found again (all awake) on the next update, so only
+        //    the new node needs marking now
+        invalidateIslands();
+        awake.push_back(1);
+        obj->boundArrays = nodes.get();
+        obj->boundIndex = index;
+        return index;
+    }
+//take over a muscle whose ends are both already in this world; false if they are not
+    bool add(MusclePtr musc)
+    {
+        if( !musc->objectA or !musc->objectB or !contains(*musc->objectA) or !contains(*musc->objectB) )
+            return false;
+        musc->removeFromEnds();
+        musc->boundSprings = springs.get();
+        musc->springIndex = muscles.size();
+        muscles.push_back(musc);
+        springs->nodeA.push_back(musc->objectA->getWorldIndex());
+        springs->nodeB.push_back(musc->objectB->getWorldIndex());
+        springs->desiredLength.push_back(musc->desiredLength());
+        springs->rigidity.push_back(musc->rigidity());
+        springs->length.push_back(0.0);
+        for(unsigned d = 0; d < MAX_DIMENSIONS; ++d)
+            springs->direction[d].push_back(0.0);
+        measureSpring<Dims>(springs->length.size() - 1, *springs, *nodes);
+        coloringValid = false;
+        invalidateIslands();
+        return true;
+    }
+//hold the ends of a bone together; false unless they are both already in this world
+    bool add(BonePtr bone)
+    {
+        PositionableObjectPtr a = bone->getEndA(), b = bone->getEndB();
+        if( !a or !b or !contains(*a) or !contains(*b) )
+            return false;
+        boneParts.push_back(bone);
+        bones.nodeA.push_back(a->getWorldIndex());
+        bones.nodeB.push_back(b->getWorldIndex());
+        bones.length.push_back(bone->getLength()());
+        isBoneNode.resize(objects.size(), 0);
+        for(uint32_t end : {bones.nodeA.back(), bones.nodeB.back()})
+        {
+            if( !isBoneNode[end] )
+                boneNodes.push_back(end);
+            isBoneNode[end] = 1;
+        }
+        for(unsigned d = 0; d < Dims; ++d)
+            boneStart[d].resize(boneNodes.size());
+        invalidateIslands();
+        return true;
+    }
+//accessors
+    std::vector<PositionableObjectPtr>::iterator begin() {return objects.begin();}
+    std::vector<PositionableObjectPtr>::iterator end() {return objects.end();}
+    size_t getNodeCount() const {return objects.size();}
+    size_t getSpringCount() const {return muscles.size();}
+    size_t getBoneCount() const {return boneParts.size();}
+    const BoneArrays& getBones() const {return bones;}
+//more sweeps over the bones make them stiffer
+    int getBoneIterations() const {return boneIterations;}
+    void setBoneIterations(int iterations) {boneIterations = iterations;}
+    bool contains(const PositionableObject& obj) const {return obj.boundArrays == nodes.get();}
+    bool contains(const Muscle& musc) const {return musc.boundSprings == springs.get();}
+    const NodeArrays& getNodes() const {return *nodes;}
+    const SpringArrays& getSprings() const {return *springs;}
+    PositionableObject::PositTy getGroundLevel() const {return groundLevel;}
+    void setGroundLevel(PositionableObject::PositTy level) {groundLevel = level; updateContacts(); wakeAll();}
+//a null terrain goes back to the flat ground level
+    TerrainPtr getTerrain() const {return terrain;}
+    void setTerrain(TerrainPtr t) {terrain = t; updateContacts(); wakeAll();}
+    const ContactModel& getContactModel() const {return contactModel;}
+    void setContactModel(const ContactModel& model) {contactModel = model;}
+    PositionableObject::PositTy getGroundHeight(PositionableObject::PositTy x, PositionableObject::PositTy z = PositionableObject::PositTy(0.0)) const
+    {
+        return PositionableObject::PositTy(groundHeight(x(), z()));
+    }
+//whether obj is at or below the ground; an object in this world answers from
+//    the last update
+    bool isTouchingGround(const PositionableObject& obj) const
+    {
+        if( contains(obj) ) return nodes->contact[obj.getWorldIndex()];
+        return obj.getPosY()() <= groundHeight(obj.getPosX()(), obj.getPosZ()());
+    }
+    ForceFields& getForceFields() {return fields;}
+//the spring pass runs in parallel on pool (which we do not own) once there
+//    are at least threshold springs
+    void setThreadPool(ThreadPool* p) {pool = p;}
+    void setSpringPass(SpringPassTy pass) {springPass = pass;}
+    void setParallelThreshold(size_t threshold) {parallelThreshold = threshold;}
+//let islands whose kinetic energy stays below energy for ticks updates in a
+//    row sleep; ticks of 0 keeps everything awake.  A sleeping island wakes
+//    when one of its muscles changes length, a force source on one of its
+//    nodes pushes, the ground changes, or the fields and ground contacts on
+//    it stop balancing out (see wakePushedIslands())
+    void setSleeping(units::energy::joule_t energy, int ticks)
+    {
+        sleepEnergy = energy();
+        sleepTicks = ticks;
+        wakeAll();
+    }
+    size_t getIslandCount()
+    {
+        if( !islandsValid ) findIslands();
+        return islandAsleep.size();
+    }
+    bool isAsleep(const PositionableObject& obj) const {return contains(obj) and !awake[obj.getWorldIndex()];}
+//step adaptively; each update() still covers exactly tick, so whatever
+//    updates the creatures between updates (their axons) keeps a fixed rate.
+//    False, and nothing changed, unless tick, tol and shortest are positive
+//    and longest is at least shortest (a step that could shrink to nothing
+//    would never get through the tick)
+    bool setAdaptiveStepping(units::time::second_t tick, units::length::meter_t tol,
+                             units::time::second_t shortest, units::time::second_t longest)
+    {
+        if( !(tick() > 0 and tol() > 0 and shortest() > 0 and longest() >= shortest()) or
+            !std::isfinite(tick()) or !std::isfinite(longest()) ) return false;
+        adaptive = true;
+        tickLength = tick();
+        tolerance = tol();
+        minStep = shortest();
+        maxStep = longest();
+        step = std::min(maxStep, tickLength);
+        return true;
+    }
+//back to one step of TIME_RATE per update
+    void setFixedStepping() {adaptive = false;}
+    bool isAdaptive() const {return adaptive;}
+//the time one update() covers
+    units::time::second_t getTickLength() const {return units::time::second_t(adaptive and !deterministic ? tickLength : TIME_RATE());}
+//steps taken, and (adaptive mode only) steps thrown away for being too long
+    size_t getStepCount() const {return stepCount;}
+    size_t getRejectedCount() const {return rejectedCount;}
+//step in fixed point, so that the same world (built in the same order, and
+//    with force sources and axons that are deterministic themselves) gives the
+//    same bits on any machine and thread count.  Turning it on rounds the
+//    state to fixed point; adaptive stepping is not used while it is on
+    void setDeterministic(bool on)
+    {
+        deterministic = on;
+        fixedValid = false;
+    }
+    bool isDeterministic() const {return deterministic;}
+//the raw fixed point position and velocity of every node, for checking that
+//    two deterministic runs agree bit for bit; empty before the first
+//    deterministic step
+    std::vector<int64_t> getFixedState() const
+    {
+        std::vector<int64_t> state;
+        if( !deterministic or !fixedValid ) return state;
+        for(unsigned d = 0; d < Dims; ++d)
+            for(size_t i = 0; i < fixedPos[d].size(); ++i)
+            {
+                state.push_back(fixedPos[d][i].getRaw());
+                state.push_back(fixedVel[d][i].getRaw());
+            }
+        return state;
+    }
+//sum up energy and momentum as the world steps, for getMetrics()
+    void setMeasuring(bool on)
+    {
+        measuring = on;
+        metrics.clear();
+    }
+    bool isMeasuring() const {return measuring;}
+    const PhysicsMetrics& getMetrics() const {return metrics;}
+//stop moving once the kinetic and spring energy passes energy, or anything
+//    stops being finite, which is what an exploding simulation looks like;
+//    turns measuring on.  0 never stops on energy, but still on NaN
+    void setDivergenceLimit(units::energy::joule_t energy)
+    {
+        divergenceEnergy = energy();
+        diverged = false;
+        setMeasuring(true);
+    }
+//whether the world has stopped for diverging; anything being evaluated in
+//    it can be given up on
+    bool hasDiverged() const {return diverged;}
+    size_t getColorCount()
+    {
+        if( !coloringValid ) colorSprings();
+        return colorBegin.size() - 1;
+    }
+//move every object forward by one tick: a single step of TIME_RATE, or in
+//    adaptive mode as many steps as it takes to cover the tick length
+    void update()
+    {
+        if( diverged ) return;
+        bool sleeping = sleepTicks > 0;
+        if( sleeping and !islandsValid )
+            findIslands();
+        if( sleeping )
+            for(uint32_t s : springs->changed)
+                wakeIsland(islandOf[springs->nodeA[s]]);
+        springs->changed.clear();
+        if( deterministic and !fixedValid )
+            fixState();
+        computeForces();
+        if( deterministic )
+        {
+            moveNodesFixed();
+            ++stepCount;
+        }
+        else if( adaptive )
+            stepAdaptively();
+        else
+        {
+            moveNodes(TIME_RATE());
+            ++stepCount;
+        }
+        if( sleeping )
+            settleIslands();
+        if( measuring )
+        {
+            double energy = metrics.kineticEnergy + metrics.springEnergy;
+            diverged = !metrics.isFinite() or (divergenceEnergy > 0 and energy > divergenceEnergy);
+        }
+    }
+};
+
+typedef BasicPhysicsWorld<3> PhysicsWorld3;
+
+}; //namespace EVOL_NS
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef _SENSOR_AXONS_H__
+#define _SENSOR_AXONS_H__
+
+#include "config.h"
+#include <cmath>
+#include <cstddef>
+#include <map>
+#include <string>
+#include "Axon.h"
+#include "Force.h"
+#include "Muscle.h"
+#include "SimulationContext.h"
+
+namespace EVOL_NS {
+
+//------------- Axons that read the state of the body -------------
+
+//outputs a quantity measured from the physics world, so that a controller
+//    can react to what its body is doing; final for the same reason as the
+//    axon kinds in AxonTypes.h
+class SensorAxon final : public Axon {
+public:
+    enum QuantityTy {
+        NODE_POS_X,     //position/velocity of nodeA, in meters and meters/second
+        NODE_POS_Y,
+        NODE_VEL_X,
+        NODE_VEL_Y,
+        NODE_POS_Z,     //only move in 3D
+        NODE_VEL_Z,
+        GROUND_CONTACT, //1 if nodeA is touching the ground, otherwise 0
+        MUSCLE_LENGTH,  //length of the muscle, in meters
+        MUSCLE_STRAIN,  //(length - rest length) / rest length of the muscle
+        ORIENTATION,    //angle of the line from nodeA to nodeB in the x-y plane, in radians
+        QUANTITY_COUNT
+    };
+private:
+    QuantityTy quantity;
+    PositionableObjectPtr nodeA, nodeB;
+    MusclePtr muscle;
+    virtual Axon::OutputTy calculateNewOutput(SimulationContext& ctx) {return compute(ctx);}
+public:
+//a quantity of a single node
+    SensorAxon(QuantityTy q, PositionableObjectPtr node) : quantity(q), nodeA(node) {}
+//a quantity of a muscle
+    SensorAxon(QuantityTy q, MusclePtr m) : quantity(q), muscle(m) {}
+//the orientation of the line between two nodes
+    SensorAxon(PositionableObjectPtr a, PositionableObjectPtr b) : quantity(ORIENTATION), nodeA(a), nodeB(b) {}
+    QuantityTy getQuantity() const {return quantity;}
+//the nodes that are read; for muscle quantities, the muscle's ends
+    PositionableObjectPtr getNodeA() {return muscle ? muscle->getEndA() : nodeA;}
+    PositionableObjectPtr getNodeB() {return muscle ? muscle->getEndB() : nodeB;}
+    MusclePtr getMuscle() {return muscle;}
+    Axon::OutputTy compute(SimulationContext& ctx)
+    {
+        switch( quantity )
+        {
+        case NODE_POS_X: return nodeA->getPosX()();
+        case NODE_POS_Y: return nodeA->getPosY()();
+        case NODE_VEL_X: return nodeA->getVelX()();
+        case NODE_VEL_Y: return nodeA->getVelY()();
+        case NODE_POS_Z: return nodeA->getPosZ()();
+        case NODE_VEL_Z: return nodeA->getVelZ()();
+        case GROUND_CONTACT: return ctx.getWorld().isTouchingGround(*nodeA) ? 1 : 0;
+        case MUSCLE_LENGTH: return muscle->getMuscleLength()();
+        case MUSCLE_STRAIN: return (muscle->getMuscleLength() / muscle->getRestLength()) - 1;
+        default: return std::atan2((nodeB->getPosY() - nodeA->getPosY())(), (nodeB->getPosX() - nodeA->getPosX())());
+        }
+    }
+    virtual std::string getTypeAsString() {return "SensorAxon";}
+    virtual BodyPartPtr clone() {return BodyPartPtr(new SensorAxon(*this));}
+    virtual void remapLinks(const std::map<BodyPart*,BodyPartPtr>& parts,
+                            const std::map<PositionableObject*,PositionableObjectPtr>& nodes)
+    {
+        if( muscle )
+        {
+            auto result = parts.find(muscle.get());
+            if( result != parts.end() )
+                muscle = std::dynamic_pointer_cast<Muscle>(result->second);
+        }
+        for(PositionableObjectPtr* node : {&nodeA, &nodeB})
+        {
+            auto result = nodes.find(node->get());
+            if( *node and result != nodes.end() )
+                *node = result->second;
+        }
+    }
+};
+
+//the batched form of SensorAxon::compute() for count sensors of quantity Q,
+//    all reading the same world: sensor i reads node nodeA[i] (and nodeB[i]
+//    for orientation), or for muscles the length the world measured for
+//    spring[i] and restLength[i] for strain, and writes to out[i]
+template<SensorAxon::QuantityTy Q, class IndexTy>
+void gatherSensors(size_t count, const IndexTy* nodeA, const IndexTy* nodeB, const IndexTy* spring, const double* restLength,
+                   const NodeArrays& n, const SpringArrays& springs, Axon::OutputTy* out)
+{
+    for(size_t i = 0; i < count; ++i)
+    {
+        IndexTy a = nodeA[i], b = nodeB[i];
+        switch( Q )
+        {
+        case SensorAxon::NODE_POS_X: out[i] = n.pos[0][a]; break;
+        case SensorAxon::NODE_POS_Y: out[i] = n.pos[1][a]; break;
+        case SensorAxon::NODE_VEL_X: out[i] = n.vel[0][a]; break;
+        case SensorAxon::NODE_VEL_Y: out[i] = n.vel[1][a]; break;
+        case SensorAxon::NODE_POS_Z: out[i] = n.pos[2][a]; break;
+        case SensorAxon::NODE_VEL_Z: out[i] = n.vel[2][a]; break;
+        case SensorAxon::GROUND_CONTACT: out[i] = n.contact[a]; break;
+        case SensorAxon::MUSCLE_LENGTH: out[i] = springs.length[spring[i]]; break;
+        case SensorAxon::MUSCLE_STRAIN: out[i] = springs.length[spring[i]] / restLength[i] - 1; break;
+        default: out[i] = std::atan2(n.pos[1][b] - n.pos[1][a], n.pos[0][b] - n.pos[0][a]); break;
+        }
+    }
+}
+
+//pick the kernel for a quantity known only at run time
+template<class IndexTy>
+void gatherSensors(SensorAxon::QuantityTy quantity, size_t count, const IndexTy* nodeA, const IndexTy* nodeB, const IndexTy* spring,
+                   const double* restLength, const NodeArrays& n, const SpringArrays& springs, Axon::OutputTy* out)
+{
+    switch( quantity )
+    {
+    case SensorAxon::NODE_POS_X: gatherSensors<SensorAxon::NODE_POS_X>(count, nodeA, nodeB, spring, restLength, n, springs, out); break;
+    case SensorAxon::NODE_POS_Y: gatherSensors<SensorAxon::NODE_POS_Y>(count, nodeA, nodeB, spring, restLength, n, springs, out); break;
+    case SensorAxon::NODE_VEL_X: gatherSensors<SensorAxon::NODE_VEL_X>(count, nodeA, nodeB, spring, restLength, n, springs, out); break;
+    case SensorAxon::NODE_VEL_Y: gatherSensors<SensorAxon::NODE_VEL_Y>(count, nodeA, nodeB, spring, restLength, n, springs, out); break;
+    case SensorAxon::NODE_POS_Z: gatherSensors<SensorAxon::NODE_POS_Z>(count, nodeA, nodeB, spring, restLength, n, springs, out); break;
+    case SensorAxon::NODE_VEL_Z: gatherSensors<SensorAxon::NODE_VEL_Z>(count, nodeA, nodeB, spring, restLength, n, springs, out); break;
+    case SensorAxon::GROUND_CONTACT: gatherSensors<SensorAxon::GROUND_CONTACT>(count, nodeA, nodeB, spring, restLength, n, springs, out); break;
+    case SensorAxon::MUSCLE_LENGTH: gatherSensors<SensorAxon::MUSCLE_LENGTH>(count, nodeA, nodeB, spring, restLength, n, springs, out); break;
+    case SensorAxon::MUSCLE_STRAIN: gatherSensors<SensorAxon::MUSCLE_STRAIN>(count, nodeA, nodeB, spring, restLength, n, springs, out); break;
+    default: gatherSensors<SensorAxon::ORIENTATION>(count, nodeA, nodeB, spring, restLength, n, springs, out); break;
+    }
+}
+
+}; //namespace EVOL_NS
+
+#endif
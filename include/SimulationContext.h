@@ -0,0 +1,69 @@
+#ifndef _SIMULATION_CONTEXT_H__
+#define _SIMULATION_CONTEXT_H__
+
+#include "config.h"
+#include <memory>
+#include <ostream>
+#include <random>
+#include <string>
+#include "PhysicsWorld.h"
+
+namespace EVOL_NS {
+
+//receives a record of the state of a simulation every tick it is traced
+class TraceSink {
+public:
+    virtual ~TraceSink() {}
+//called once at the start of each traced tick
+    virtual void beginTick(int tick)=0;
+//a single named value; the type may be blank
+    virtual void record(const std::string& name, const std::string& type, const std::string& value)=0;
+};
+
+typedef std::shared_ptr<TraceSink> TraceSinkPtr;
+
+//writes the trace out as human readable text
+class StreamTraceSink : public TraceSink {
+    std::ostream& os;
+public:
+    StreamTraceSink(std::ostream& o) : os(o) {}
+    virtual void beginTick(int tick) { os << "---------Gen " << tick << "---------\n"; }
+    virtual void record(const std::string& name, const std::string& type, const std::string& value)
+    {
+        os << name;
+        if( !type.empty() ) os << "(" << type << ")";
+        if( !value.empty() ) os << " : " << value;
+        os << "\n";
+    }
+};
+
+//everything a simulation needs that is not part of the creature itself;
+//    contexts share nothing, so any number of simulations can run side by
+//    side in one process, each with its own clock
+class SimulationContext {
+public:
+    typedef std::mt19937 RngTy;
+private:
+    int ticks;
+    PhysicsWorld world;
+    RngTy rng;
+//null unless someone is watching this simulation
+    TraceSinkPtr traceSink;
+public:
+    SimulationContext(RngTy::result_type seed = RngTy::default_seed) : ticks(0), rng(seed) {}
+//the clock
+    int getTicks() const {return ticks;}
+    void advanceTick() {++ticks;}
+//the objects moved by physics
+    PhysicsWorld& getWorld() {return world;}
+//seeded per context so that a simulation is reproducible on its own
+    RngTy& getRng() {return rng;}
+//tracing
+    void setTraceSink(TraceSinkPtr sink) {traceSink = sink;}
+    bool isTracing() const {return (bool)traceSink;}
+    TraceSink& getTraceSink() {return *traceSink;}
+};
+
+}; //namespace EVOL_NS
+
+#endif
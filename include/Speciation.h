@@ -0,0 +1,249 @@
+#ifndef _SPECIATION_H__
+#define _SPECIATION_H__
+
+#include "config.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "AxonTypes.h"
+#include "Bone.h"
+#include "Creature.h"
+#include "Muscle.h"
+#include "SimulationContext.h"
+#include "ThreadPool.h"
+
+namespace EVOL_NS {
+
+//hands out innovation numbers: the first creature to have a given piece of
+//    structure gives it the next number, and every creature with the same
+//    structure after that gets the same one.  Safe to share between threads
+class InnovationTracker {
+    std::mutex mutex;
+    std::unordered_map<std::string,uint32_t> numbers;
+public:
+    uint32_t innovationOf(const std::string& structure)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto result = numbers.insert(std::make_pair(structure, uint32_t(numbers.size())));
+        return result.first->second;
+    }
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return numbers.size();
+    }
+};
+
+//one piece of a creature's structure, and the number (rigidity, constant,
+//    ...) that goes with it
+struct Gene {
+    uint32_t innovation;
+    double weight;
+    bool operator < (const Gene& other) const {return innovation < other.innovation;}
+};
+
+//a creature's structure as genes sorted by innovation number, so that two
+//    genomes can be lined up in a single merge
+class Genome {
+    std::vector<Gene> genes;
+public:
+    Genome() {}
+    Genome(std::vector<Gene> g) : genes(std::move(g)) {std::sort(genes.begin(), genes.end());}
+    const std::vector<Gene>& getGenes() const {return genes;}
+    size_t size() const {return genes.size();}
+//the genes of a creature: one per node and part, one per end of each muscle
+//    and bone, and one per axon input.  Structure is told apart by the names
+//    of the parts involved, so creatures derived from a common ancestor share
+//    innovation numbers wherever they still match
+    static Genome of(const Creature& creature, InnovationTracker& tracker)
+    {
+        std::map<const void*,std::string> names;
+        for(auto NI = creature.nodeBegin(); NI != creature.nodeEnd(); ++NI)
+            names[NI->second.get()] = NI->first;
+        for(auto BI = creature.begin(); BI != creature.end(); ++BI)
+            if( Axon* axe = dynamic_cast<Axon*>(BI->second.get()) )
+                names[axe] = BI->first;
+        std::vector<Gene> genes;
+        auto add = [&](const std::string& structure, double weight) {
+            genes.push_back(Gene{tracker.innovationOf(structure), weight});
+        };
+        for(auto NI = creature.nodeBegin(); NI != creature.nodeEnd(); ++NI)
+            add("node " + NI->first, units::mass::kilogram_t(NI->second->getMass())());
+        for(auto BI = creature.begin(); BI != creature.end(); ++BI)
+        {
+            BodyPart* part = BI->second.get();
+            double weight = 0.0;
+            PositionableObjectPtr a, b;
+            if( ConstAxon* c = dynamic_cast<ConstAxon*>(part) ) weight = c->getConstValue();
+            if( Muscle* m = dynamic_cast<Muscle*>(part) )
+            {
+                weight = m->getRigidity()();
+                a = m->getEndA();
+                b = m->getEndB();
+            }
+            if( Bone* bone = dynamic_cast<Bone*>(part) )
+            {
+                weight = bone->getLength()();
+                a = bone->getEndA();
+                b = bone->getEndB();
+            }
+            add("part " + part->getTypeAsString() + " " + BI->first, weight);
+            if( a and b )
+                add("ends " + BI->first + " " + names[a.get()] + " " + names[b.get()], 0.0);
+            if( CanHaveAxonInputs* base = dynamic_cast<CanHaveAxonInputs*>(part) )
+            {
+                //the same input twice is two genes
+                std::map<std::string,int> seen;
+                for(auto II = base->inputBegin(); II != base->inputEnd(); ++II)
+                {
+                    std::string from = names.count(II->get()) ? names[II->get()] : "?";
+                    add("input " + from + " " + BI->first + " " + std::to_string(seen[from]++), 1.0);
+                }
+            }
+        }
+        return Genome(std::move(genes));
+    }
+};
+
+//how much excess genes (past the end of the other genome), disjoint genes
+//    (missing from the other genome within its range) and the mean weight
+//    difference of matching genes count towards compatibility distance
+struct CompatibilityCoefficients {
+    double excess, disjoint, weight;
+    CompatibilityCoefficients(double c1 = 1.0, double c2 = 1.0, double c3 = 0.4) : excess(c1), disjoint(c2), weight(c3) {}
+};
+
+//NEAT's compatibility distance, in one pass over both gene lists; the
+//    gene counts are normalized by the larger genome, unless both are small
+inline double compatibility(const Genome& a, const Genome& b, const CompatibilityCoefficients& c)
+{
+    const std::vector<Gene>& ga = a.getGenes();
+    const std::vector<Gene>& gb = b.getGenes();
+    size_t ia = 0, ib = 0, disjoint = 0, matching = 0;
+    double weightDiff = 0.0;
+    while( ia < ga.size() and ib < gb.size() )
+    {
+        if( ga[ia].innovation == gb[ib].innovation )
+        {
+            weightDiff += std::abs(ga[ia++].weight - gb[ib++].weight);
+            ++matching;
+        }
+        else if( ga[ia].innovation < gb[ib].innovation ) {++ia; ++disjoint;}
+        else {++ib; ++disjoint;}
+    }
+    size_t excess = (ga.size() - ia) + (gb.size() - ib);
+    size_t larger = std::max(ga.size(), gb.size());
+    double n = larger < 20 ? 1.0 : double(larger);
+    return c.excess * excess / n + c.disjoint * disjoint / n + c.weight * (matching ? weightDiff / matching : 0.0);
+}
+
+//sorts each generation into species of compatible genomes.  Each species
+//    keeps a copy of one member of the last generation as its
+//    representative; a genome joins the first species whose representative
+//    is within the threshold, or founds a new one
+class Speciation {
+public:
+    static const size_t NONE = size_t(-1);
+    struct Species {
+        uint32_t id;
+        Genome representative;
+        std::vector<size_t> members;
+//generations the species has lived through
+        int age;
+    };
+private:
+    CompatibilityCoefficients coefficients;
+    double threshold;
+//when not 0, the threshold is nudged after every generation to head for
+//    this many species
+    size_t targetCount;
+    double thresholdStep;
+    std::vector<Species> species;
+    std::vector<size_t> speciesOf;
+    uint32_t nextId;
+public:
+    Speciation(double t = 3.0, CompatibilityCoefficients c = CompatibilityCoefficients()) :
+        coefficients(c), threshold(t), targetCount(0), thresholdStep(0.1), nextId(0) {}
+    double getThreshold() const {return threshold;}
+    void setThreshold(double t) {threshold = t;}
+    void setTargetCount(size_t count, double step = 0.1) {targetCount = count; thresholdStep = step;}
+//sort a generation into species, with the comparisons against the existing
+//    representatives split across pool if given.  Genomes that match none
+//    are then gone through in order, founding species as needed, so the
+//    result is the same however the work was split.  Species left empty
+//    die out, and each survivor takes a random member as its representative
+    void assign(const std::vector<Genome>& generation, SimulationContext::RngTy& rng, ThreadPool* pool = nullptr)
+    {
+        size_t existing = species.size();
+        speciesOf.assign(generation.size(), size_t(NONE));
+        auto match = [&](size_t begin, size_t end, unsigned) {
+            for(size_t i = begin; i < end; ++i)
+                for(size_t s = 0; s < existing; ++s)
+                    if( compatibility(generation[i], species[s].representative, coefficients) < threshold )
+                    {
+                        speciesOf[i] = s;
+                        break;
+                    }
+        };
+        if( pool )
+            pool->parallelFor(generation.size(), match);
+        else
+            match(0, generation.size(), 0);
+        for(size_t i = 0; i < generation.size(); ++i)
+        {
+            if( speciesOf[i] != NONE ) continue;
+            for(size_t s = existing; s < species.size() and speciesOf[i] == NONE; ++s)
+                if( compatibility(generation[i], species[s].representative, coefficients) < threshold )
+                    speciesOf[i] = s;
+            if( speciesOf[i] == NONE )
+            {
+                speciesOf[i] = species.size();
+                species.push_back(Species{nextId++, generation[i], std::vector<size_t>(), 0});
+            }
+        }
+        for(auto& sp : species)
+            sp.members.clear();
+        for(size_t i = 0; i < generation.size(); ++i)
+            species[speciesOf[i]].members.push_back(i);
+        //close up the gaps left by empty species
+        std::vector<size_t> renumber(species.size(), size_t(NONE));
+        size_t kept = 0;
+        for(size_t s = 0; s < species.size(); ++s)
+        {
+            if( species[s].members.empty() ) continue;
+            renumber[s] = kept;
+            if( kept != s ) species[kept] = std::move(species[s]);
+            Species& sp = species[kept++];
+            sp.representative = generation[sp.members[std::uniform_int_distribution<size_t>(0, sp.members.size() - 1)(rng)]];
+            ++sp.age;
+        }
+        species.resize(kept);
+        for(auto& s : speciesOf)
+            s = renumber[s];
+        if( targetCount )
+        {
+            if( species.size() < targetCount ) threshold = std::max(thresholdStep, threshold - thresholdStep);
+            if( species.size() > targetCount ) threshold += thresholdStep;
+        }
+    }
+    size_t getSpeciesCount() const {return species.size();}
+    const Species& getSpecies(size_t s) const {return species[s];}
+//the species genome i of the last generation went to
+    size_t getSpeciesOf(size_t i) const {return speciesOf[i];}
+//explicit fitness sharing: each genome's fitness divided by the size of its species
+    void shareFitness(const double* fitness, double* adjusted) const
+    {
+        for(size_t i = 0; i < speciesOf.size(); ++i)
+            adjusted[i] = fitness[i] / species[speciesOf[i]].members.size();
+    }
+};
+
+}; //namespace EVOL_NS
+
+#endif
@@ -0,0 +1,264 @@
+#ifndef _STEADY_STATE_H__
+#define _STEADY_STATE_H__
+
+#include "config.h"
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <vector>
+#include "Creature.h"
+#include "Evaluation.h"
+#include "ThreadPool.h"
+
+namespace EVOL_NS {
+
+//steady-state evolution with no generations: every worker on its own pulls
+//    a parent out of the shared population by tournament, varies and
+//    evaluates it, and puts the child back in over a poor member, then
+//    starts on the next one straight away.  Nobody waits for the slowest
+//    evaluation of a batch.  Members are guarded by striped locks as in
+//    EliteGrid, and their fitness is also kept in atomics so tournaments can
+//    be decided without taking any lock
+class SteadyState {
+public:
+    enum ReplacementTy {
+        INVERSE_TOURNAMENT, //the worst of a random tournament, if the child beats it
+        WORST               //the worst of the whole population, if the child beats it
+    };
+    struct Member {
+        Creature creature;
+        Evaluation evaluation;
+    };
+    struct RunReport {
+        size_t evaluated, inserted;
+        double bestFitness, worstFitness, meanFitness;
+    };
+private:
+    struct Stripe {
+        std::mutex mutex;
+        char padding[64];
+    };
+    Evaluator& evaluator;
+    VariationFn vary;
+    ThreadPool* pool;
+    std::vector<Member> population;
+    std::unique_ptr<std::atomic<double>[]> fitness;
+    std::unique_ptr<Stripe[]> stripes;
+    size_t stripeCount;
+//the slots as a min-heap on fitness, so the worst member is always at the
+//    top: heap[heapPos[s]] == s, and heapFitness is the fitness each slot
+//    had when the heap last heard of it.  Guarded by heapMutex; no stripe's
+//    lock is ever taken while holding it
+    mutable std::mutex heapMutex;
+    std::vector<size_t> heap, heapPos;
+    std::vector<double> heapFitness;
+    unsigned tournamentSize;
+    ReplacementTy replacement;
+    Evaluator::SeedTy seed;
+//one generator per worker, kept from one run to the next
+    std::vector<SimulationContext::RngTy> rngs;
+    std::atomic<bool> stopping;
+    Stripe& stripeOf(size_t slot) const {return stripes[slot % stripeCount];}
+    size_t randomSlot(SimulationContext::RngTy& rng) const
+    {
+        return std::uniform_int_distribution<size_t>(0, population.size() - 1)(rng);
+    }
+    size_t pickParent(SimulationContext::RngTy& rng) const
+    {
+        size_t best = randomSlot(rng);
+        for(unsigned t = 1; t < tournamentSize; ++t)
+        {
+            size_t other = randomSlot(rng);
+            if( fitness[other].load(std::memory_order_relaxed) > fitness[best].load(std::memory_order_relaxed) )
+                best = other;
+        }
+        return best;
+    }
+    size_t pickVictim(SimulationContext::RngTy& rng) const
+    {
+        if( replacement == WORST ) return worstSlot();
+        size_t worst = randomSlot(rng);
+        for(unsigned t = 1; t < tournamentSize; ++t)
+        {
+            size_t other = randomSlot(rng);
+            if( fitness[other].load(std::memory_order_relaxed) < fitness[worst].load(std::memory_order_relaxed) )
+                worst = other;
+        }
+        return worst;
+    }
+    size_t worstSlot() const
+    {
+        std::lock_guard<std::mutex> lock(heapMutex);
+        return heap[0];
+    }
+//move the slot at heap position i down until neither child is less fit
+    void siftDown(size_t i)
+    {
+        for(;;)
+        {
+            size_t least = i;
+            for(size_t child = 2 * i + 1; child <= 2 * i + 2 and child < heap.size(); ++child)
+                if( heapFitness[heap[child]] < heapFitness[heap[least]] )
+                    least = child;
+            if( least == i ) return;
+            std::swap(heap[i], heap[least]);
+            heapPos[heap[i]] = i;
+            heapPos[heap[least]] = least;
+            i = least;
+        }
+    }
+//tell the heap the member in slot now has fitness f, which is never lower
+//    than before, and publish the new worst
+    void raise(size_t slot, double f)
+    {
+        std::lock_guard<std::mutex> lock(heapMutex);
+        heapFitness[slot] = f;
+        siftDown(heapPos[slot]);
+        publishThreshold();
+    }
+//put child over the member in slot if it is better; the slot may have been
+//    replaced since it was picked, so its fitness is checked again under the lock
+    bool replace(size_t slot, const Creature& child, const Evaluation& evaluation)
+    {
+        if( evaluation.terminated or evaluation.fitness != evaluation.fitness ) return false;
+        if( evaluation.fitness <= fitness[slot].load(std::memory_order_relaxed) ) return false;
+        std::lock_guard<std::mutex> lock(stripeOf(slot).mutex);
+        if( evaluation.fitness <= fitness[slot].load(std::memory_order_relaxed) ) return false;
+        population[slot].creature = child;
+        population[slot].evaluation = evaluation;
+        fitness[slot].store(evaluation.fitness, std::memory_order_relaxed);
+        raise(slot, evaluation.fitness);
+        return true;
+    }
+//no child worse than the worst member can ever get in, so evaluations can
+//    give up on those; the heap must be locked, or not yet shared
+    void publishThreshold() {evaluator.setThreshold(heapFitness[heap[0]]);}
+    RunReport report(size_t evaluated, size_t inserted) const
+    {
+        RunReport r = {evaluated, inserted, -std::numeric_limits<double>::infinity(),
+                       std::numeric_limits<double>::infinity(), 0.0};
+        for(size_t s = 0; s < population.size(); ++s)
+        {
+            double f = fitness[s].load(std::memory_order_relaxed);
+            r.bestFitness = std::max(r.bestFitness, f);
+            r.worstFitness = std::min(r.worstFitness, f);
+            r.meanFitness += f / population.size();
+        }
+        return r;
+    }
+public:
+//the evaluator's threshold is kept at the fitness of the worst member, so
+//    that a termination policy on it stops children that cannot get in
+    SteadyState(Evaluator& e, VariationFn v, ThreadPool* p = nullptr,
+                SimulationContext::RngTy::result_type rngSeed = SimulationContext::RngTy::default_seed,
+                size_t locks = 64) :
+        evaluator(e), vary(v), pool(p), stripes(new Stripe[std::max<size_t>(1, locks)]), stripeCount(std::max<size_t>(1, locks)),
+        tournamentSize(2), replacement(INVERSE_TOURNAMENT), seed(SimulationContext::RngTy::default_seed), stopping(false)
+    {
+        unsigned workers = pool ? pool->getThreadCount() : 1;
+        for(unsigned w = 0; w < workers; ++w)
+        {
+            std::seed_seq seq{rngSeed, SimulationContext::RngTy::result_type(w)};
+            rngs.push_back(SimulationContext::RngTy(seq));
+        }
+    }
+    void setTournamentSize(unsigned size) {tournamentSize = std::max(1u, size);}
+    void setReplacement(ReplacementTy r) {replacement = r;}
+    void setEvaluationSeed(Evaluator::SeedTy s) {seed = s;}
+    size_t size() const {return population.size();}
+//the member in slot, which must not be changing: call between runs
+    const Member& getMember(size_t slot) const {return population[slot];}
+//start over with population, evaluated as given
+    RunReport seedWith(const std::vector<Creature>& start)
+    {
+        std::vector<Evaluation> results;
+        evaluator.evaluate(start, results, pool, seed);
+        population.clear();
+        fitness.reset(new std::atomic<double>[start.size()]);
+        heap.resize(start.size());
+        heapPos.resize(start.size());
+        heapFitness.resize(start.size());
+        for(size_t i = 0; i < start.size(); ++i)
+        {
+            population.push_back(Member{start[i], results[i]});
+            double f = results[i].fitness;
+            fitness[i].store(f == f ? f : -std::numeric_limits<double>::infinity());
+            heapFitness[i] = fitness[i].load();
+            heap[i] = heapPos[i] = i;
+        }
+        for(size_t i = heap.size() / 2; i-- > 0;)
+            siftDown(i);
+        if( !population.empty() ) publishThreshold();
+        return report(start.size(), start.size());
+    }
+//make and offer evaluations more children, spread over the workers as they
+//    become free, and return once all of them are in (or stop() was called)
+    RunReport run(size_t evaluations)
+    {
+        if( population.empty() ) return report(0, 0);
+        stopping = false;
+        std::atomic<size_t> started(0), finished(0), inserted(0);
+        auto work = [&](size_t begin, size_t end, unsigned) {
+            for(size_t w = begin; w < end; ++w)
+            {
+                SimulationContext::RngTy& rng = rngs[w];
+                while( !stopping and started++ < evaluations )
+                {
+                    size_t parentSlot = pickParent(rng);
+                    Creature parent;
+                    {
+                        std::lock_guard<std::mutex> lock(stripeOf(parentSlot).mutex);
+                        parent = population[parentSlot].creature;
+                    }
+                    Creature child = vary(parent, rng);
+                    Evaluation evaluation = evaluator.evaluate(child, seed);
+                    ++finished;
+                    if( replace(pickVictim(rng), child, evaluation) )
+                        ++inserted;
+                }
+            }
+        };
+        //one job per worker, each running until the budget is used up
+        if( pool )
+            pool->parallelFor(rngs.size(), work);
+        else
+            work(0, 1, 0);
+        return report(finished, inserted);
+    }
+//evaluate creatures from outside (migrants, say) and offer each over a
+//    poor member as run() would; returns how many got in.  Call between runs
+    size_t offer(const std::vector<Creature>& outsiders)
+    {
+        if( population.empty() ) return 0;
+        std::vector<Evaluation> results;
+        evaluator.evaluate(outsiders, results, pool, seed);
+        size_t inserted = 0;
+        for(size_t i = 0; i < outsiders.size(); ++i)
+            if( replace(pickVictim(rngs[0]), outsiders[i], results[i]) )
+                ++inserted;
+        return inserted;
+    }
+//the slots of the count fittest members, fittest first
+    std::vector<size_t> getBestSlots(size_t count) const
+    {
+        std::vector<size_t> slots(population.size());
+        for(size_t s = 0; s < slots.size(); ++s)
+            slots[s] = s;
+        count = std::min(count, slots.size());
+        std::partial_sort(slots.begin(), slots.begin() + count, slots.end(), [&](size_t a, size_t b) {
+            return fitness[a].load(std::memory_order_relaxed) > fitness[b].load(std::memory_order_relaxed);
+        });
+        slots.resize(count);
+        return slots;
+    }
+//have run() return as soon as the evaluations under way are done; safe to
+//    call from any thread, e.g. from within the variation function
+    void stop() {stopping = true;}
+};
+
+}; //namespace EVOL_NS
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef _SUCCESSIVE_HALVING_H__
+#define _SUCCESSIVE_HALVING_H__
+
+#include "config.h"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+#include "Creature.h"
+#include "Evaluation.h"
+#include "ThreadPool.h"
+
+namespace EVOL_NS {
+
+//evaluates a population by racing it, so that most of the ticks go to the
+//    creatures worth them: every candidate is run for a short first horizon,
+//    the best 1/eta of them are kept and run eta times as far, and so on
+//    until those left reach the evaluator's full tick count.  Survivors carry
+//    on from where the last rung left them rather than starting over, so one
+//    that runs to the end costs no more than with Evaluator::evaluate and
+//    gets the same result.  Candidates dropped on the way come back
+//    terminated, scored by the fitness function where they were dropped,
+//    with ticks saying how far that was.  Every candidate still racing is
+//    held in memory, world and all, between rungs
+class SuccessiveHalving {
+public:
+    struct Report {
+        size_t rungs, simulated, cached;
+//the ticks simulated in all, and what running every simulated candidate to
+//    the end would have taken
+        uint64_t ticks, fullTicks;
+    };
+private:
+    const Evaluator& evaluator;
+    int firstTicks;
+    unsigned eta;
+    ThreadPool* pool;
+    static double scoreOf(const Evaluation& e)
+    {
+        return e.fitness == e.fitness ? e.fitness : -std::numeric_limits<double>::infinity();
+    }
+public:
+//first is the horizon of the first rung; each later rung is reduction times
+//    as long, and keeps 1/reduction of the candidates still going
+    SuccessiveHalving(const Evaluator& e, int first, unsigned reduction = 3, ThreadPool* p = nullptr) :
+        evaluator(e), firstTicks(std::max(1, first)), eta(std::max(2u, reduction)), pool(p) {}
+    int getFirstTicks() const {return firstTicks;}
+    void setFirstTicks(int first) {firstTicks = std::max(1, first);}
+    unsigned getReduction() const {return eta;}
+    void setReduction(unsigned reduction) {eta = std::max(2u, reduction);}
+//evaluate every creature of a population as Evaluator::evaluate would, all
+//    with the same seed, but racing them.  Candidates found in the
+//    evaluator's cache are taken from there and not raced; those that finish
+//    are put in it
+    Report evaluate(const std::vector<Creature>& population, std::vector<Evaluation>& results,
+                    Evaluator::SeedTy seed = SimulationContext::RngTy::default_seed) const
+    {
+        Report report = {0, 0, 0, 0, 0};
+        results.assign(population.size(), Evaluation());
+        std::vector<std::unique_ptr<Evaluator::Simulation>> runs(population.size());
+        std::vector<size_t> racing;
+        for(size_t i = 0; i < population.size(); ++i)
+        {
+            if( evaluator.lookup(population[i], seed, results[i]) )
+                ++report.cached;
+            else
+                racing.push_back(i);
+        }
+        report.simulated = racing.size();
+        report.fullTicks = uint64_t(racing.size()) * uint64_t(std::max(0, evaluator.getTicks()));
+        auto settle = [&](size_t i, bool dropped) {
+            results[i] = evaluator.finish(*runs[i]);
+            if( dropped )
+                results[i].terminated = true;
+            else
+                evaluator.remember(population[i], seed, results[i]);
+            report.ticks += uint64_t(runs[i]->getTicks());
+            runs[i].reset();
+        };
+        int horizon = firstTicks;
+        while( !racing.empty() )
+        {
+            //one left has nothing to race against, so goes straight to the end
+            if( racing.size() == 1 ) horizon = evaluator.getTicks();
+            std::vector<char> going(racing.size());
+            auto rung = [&](size_t begin, size_t end, unsigned) {
+                for(size_t r = begin; r < end; ++r)
+                {
+                    size_t i = racing[r];
+                    if( !runs[i] ) runs[i] = evaluator.start(population[i], seed);
+                    going[r] = evaluator.advance(*runs[i], horizon);
+                }
+            };
+            if( pool )
+                pool->parallelFor(racing.size(), rung);
+            else
+                rung(0, racing.size(), 0);
+            ++report.rungs;
+            //runs that are over (done, diverged or terminated) are final as they are
+            std::vector<size_t> still;
+            for(size_t r = 0; r < racing.size(); ++r)
+            {
+                if( going[r] )
+                    still.push_back(racing[r]);
+                else
+                    settle(racing[r], false);
+            }
+            size_t keep = std::max<size_t>(1, (still.size() + eta - 1) / eta);
+            if( keep < still.size() )
+            {
+                std::stable_sort(still.begin(), still.end(), [&](size_t a, size_t b) {
+                    return scoreOf(runs[a]->getResult()) > scoreOf(runs[b]->getResult());
+                });
+                for(size_t r = keep; r < still.size(); ++r)
+                    settle(still[r], true);
+                still.resize(keep);
+                //back into population order, for the next rung
+                std::sort(still.begin(), still.end());
+            }
+            racing.swap(still);
+            horizon = horizon > evaluator.getTicks() / int(eta) ? evaluator.getTicks() : horizon * int(eta);
+        }
+        return report;
+    }
+};
+
+}; //namespace EVOL_NS
+
+#endif
@@ -0,0 +1,258 @@
+#ifndef _TERRAIN_H__
+#define _TERRAIN_H__
+
+#include "config.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Force.h"
+#include "ForceFields.h"
+#include "Muscle.h"
+
+namespace EVOL_NS {
+
+class Terrain;
+typedef std::shared_ptr<const Terrain> TerrainPtr;
+
+//the ground, as a height at each point of an evenly spaced grid over x and
+//    z, with flat triangles in between (two per grid square, split along
+//    the diagonal from its corner nearest the origin to the opposite one);
+//    beyond the edges it carries on flat.  A
+//    terrain with a single row is a line over x, for 2D worlds.  A terrain
+//    never changes once made, so one can be shared by every world (and
+//    thread) evaluating a population
+class Terrain {
+    double originX, originZ, spacing;
+    size_t columns, rows;
+//heights[row * columns + col] is at (originX + col * spacing, originZ + row * spacing)
+    std::vector<double> heights;
+//the unit normal of each triangle, worked out once so lookups are a single
+//    index calculation; triangle 2k of square k is the one below its diagonal
+    std::vector<double> normals[MAX_DIMENSIONS];
+    Terrain(double x0, double z0, double space, size_t cols, std::vector<double> h) :
+        originX(x0), originZ(z0), spacing(space), columns(cols), rows(h.size() / cols), heights(std::move(h))
+    {
+        size_t squareRows = rows > 1 ? rows - 1 : 1;
+        for(size_t row = 0; row < squareRows; ++row)
+        {
+            for(size_t col = 0; col + 1 < columns; ++col)
+            {
+                double h00, h10, h01, h11;
+                corners(col, row, h00, h10, h01, h11);
+                addNormal((h10 - h00) / spacing, (h11 - h10) / spacing);
+                addNormal((h11 - h01) / spacing, (h01 - h00) / spacing);
+            }
+        }
+    }
+    void corners(size_t col, size_t row, double& h00, double& h10, double& h01, double& h11) const
+    {
+        size_t nextRow = rows > 1 ? row + 1 : row;
+        h00 = heights[row * columns + col];
+        h10 = heights[row * columns + col + 1];
+        h01 = heights[nextRow * columns + col];
+        h11 = heights[nextRow * columns + col + 1];
+    }
+    void addNormal(double slopeX, double slopeZ)
+    {
+        double length = std::sqrt(slopeX * slopeX + 1.0 + slopeZ * slopeZ);
+        normals[0].push_back(-slopeX / length);
+        normals[1].push_back(1.0 / length);
+        normals[2].push_back(-slopeZ / length);
+    }
+//clamp a grid coordinate onto [0, last], noting whether it was off the grid
+    static double clampToGrid(double g, size_t last, bool& outside)
+    {
+        outside = !(g > 0) or g > last;
+        return !(g > 0) ? 0.0 : (g > last ? double(last) : g);
+    }
+public:
+//a line: heights[k] is the ground height at x0 + k * spacing; null unless
+//    there are at least two heights and the spacing is positive
+    static TerrainPtr make(PositionableObject::PositTy x0, PositionableObject::PositTy space, std::vector<double> heights)
+    {
+        size_t cols = heights.size();
+        return make(x0, PositionableObject::PositTy(0.0), space, cols, std::move(heights));
+    }
+//a grid of heights, columns along x and then rows along z; null unless
+//    there are at least two columns and a whole number of rows
+    static TerrainPtr make(PositionableObject::PositTy x0, PositionableObject::PositTy z0, PositionableObject::PositTy space,
+                           size_t cols, std::vector<double> heights)
+    {
+        if( cols < 2 or heights.empty() or heights.size() % cols != 0 or !(space() > 0) ) return TerrainPtr();
+        return TerrainPtr(new Terrain(x0(), z0(), space(), cols, std::move(heights)));
+    }
+//read whitespace separated heights, in meters, from a file, one row (along
+//    x) per line; null if it can't be read or the rows differ in length
+    static TerrainPtr load(std::string filename, PositionableObject::PositTy x0, PositionableObject::PositTy space,
+                           PositionableObject::PositTy z0 = PositionableObject::PositTy(0.0))
+    {
+        std::ifstream in(filename.c_str());
+        if( !in ) return TerrainPtr();
+        std::vector<double> heights;
+        size_t cols = 0;
+        std::string line;
+        while( std::getline(in, line) )
+        {
+            std::istringstream row(line);
+            size_t before = heights.size();
+            double h;
+            while( row >> h )
+                heights.push_back(h);
+            if( !row.eof() ) return TerrainPtr();
+            size_t count = heights.size() - before;
+            if( count == 0 ) continue;
+            if( cols == 0 ) cols = count;
+            if( count != cols ) return TerrainPtr();
+        }
+        return make(x0, z0, space, cols, std::move(heights));
+    }
+//a rough line by midpoint displacement over 2^detail segments: each halving
+//    of the segments adds bumps scaled down by roughness (0 to 1, higher is
+//    more jagged), starting from +-amplitude
+    static TerrainPtr generate(std::mt19937& rng, unsigned detail, PositionableObject::PositTy x0,
+                               PositionableObject::PositTy space, PositionableObject::PositTy amplitude, double roughness)
+    {
+        size_t segments = size_t(1) << detail;
+        std::vector<double> heights(segments + 1, 0.0);
+        std::uniform_real_distribution<double> bump(-1.0, 1.0);
+        double scale = amplitude();
+        heights.front() = scale * bump(rng);
+        heights.back() = scale * bump(rng);
+        for(size_t step = segments; step > 1; step /= 2)
+        {
+            scale *= roughness;
+            for(size_t k = step / 2; k < segments; k += step)
+                heights[k] = (heights[k - step/2] + heights[k + step/2]) / 2 + scale * bump(rng);
+        }
+        return make(x0, space, std::move(heights));
+    }
+//the same over a square grid of 2^detail squares a side, by diamond-square
+    static TerrainPtr generateGrid(std::mt19937& rng, unsigned detail, PositionableObject::PositTy x0, PositionableObject::PositTy z0,
+                                   PositionableObject::PositTy space, PositionableObject::PositTy amplitude, double roughness)
+    {
+        size_t segments = size_t(1) << detail, size = segments + 1;
+        std::vector<double> heights(size * size, 0.0);
+        std::uniform_real_distribution<double> bump(-1.0, 1.0);
+        double scale = amplitude();
+        for(size_t corner : {size_t(0), segments, segments * size, segments * size + segments})
+            heights[corner] = scale * bump(rng);
+        for(size_t step = segments; step > 1; step /= 2)
+        {
+            size_t half = step / 2;
+            scale *= roughness;
+            //the middle of each square from its corners
+            for(size_t row = half; row < size; row += step)
+                for(size_t col = half; col < size; col += step)
+                    heights[row * size + col] = (heights[(row - half) * size + col - half] + heights[(row - half) * size + col + half] +
+                                                 heights[(row + half) * size + col - half] + heights[(row + half) * size + col + half]) / 4
+                                                + scale * bump(rng);
+            //the middle of each edge from the points around it
+            for(size_t row = 0; row < size; row += half)
+            {
+                for(size_t col = (row / half) % 2 == 0 ? half : 0; col < size; col += step)
+                {
+                    double sum = 0.0;
+                    int count = 0;
+                    if( row >= half ) {sum += heights[(row - half) * size + col]; ++count;}
+                    if( row + half < size ) {sum += heights[(row + half) * size + col]; ++count;}
+                    if( col >= half ) {sum += heights[row * size + col - half]; ++count;}
+                    if( col + half < size ) {sum += heights[row * size + col + half]; ++count;}
+                    heights[row * size + col] = sum / count + scale * bump(rng);
+                }
+            }
+        }
+        return make(x0, z0, space, size, std::move(heights));
+    }
+//the ground height below (x, z), and the unit normal of the ground there;
+//    z is ignored by a line
+    void sample(double x, double z, double& height, double* normal) const
+    {
+        bool outsideX, outsideZ = false;
+        double gx = clampToGrid((x - originX) / spacing, columns - 1, outsideX);
+        double gz = 0.0;
+        if( rows > 1 ) gz = clampToGrid((z - originZ) / spacing, rows - 1, outsideZ);
+        size_t col = std::min<size_t>(gx, columns - 2);
+        size_t row = rows > 1 ? std::min<size_t>(gz, rows - 2) : 0;
+        double tx = gx - col, tz = gz - row;
+        double h00, h10, h01, h11;
+        corners(col, row, h00, h10, h01, h11);
+        bool upper = tz > tx;
+        if( upper )
+            height = h00 + (h11 - h01) * tx + (h01 - h00) * tz;
+        else
+            height = h00 + (h10 - h00) * tx + (h11 - h10) * tz;
+        size_t triangle = 2 * (row * (columns - 1) + col) + upper;
+        for(unsigned d = 0; d < MAX_DIMENSIONS; ++d)
+            normal[d] = normals[d][triangle];
+        if( outsideX or outsideZ )
+        {
+            //flat along whichever way we are off the grid
+            if( outsideX ) normal[0] = 0.0;
+            if( outsideZ ) normal[2] = 0.0;
+            double length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+            for(unsigned d = 0; d < MAX_DIMENSIONS; ++d)
+                normal[d] /= length;
+        }
+    }
+    double getHeight(double x, double z = 0.0) const
+    {
+        double height, normal[MAX_DIMENSIONS];
+        sample(x, z, height, normal);
+        return height;
+    }
+    size_t getColumnCount() const {return columns;}
+    size_t getRowCount() const {return rows;}
+    size_t getPointCount() const {return heights.size();}
+};
+
+//how the ground pushes back on a node below it: a damped spring along the
+//    ground's normal (a penalty force), and friction along the ground capped
+//    at the friction coefficient times that push
+struct ContactModel {
+    double stiffness, damping, friction, slipDamping;
+    ContactModel(Muscle::RigidityTy stiff = Muscle::RigidityTy(1e4), units::linear_drag::kilogram_per_second_t damp = units::linear_drag::kilogram_per_second_t(100.0),
+                 double mu = 0.8, units::linear_drag::kilogram_per_second_t slip = units::linear_drag::kilogram_per_second_t(1000.0)) :
+        stiffness(stiff()), damping(damp()), friction(mu), slipDamping(slip()) {}
+};
+
+//add the ground's force onto every node below the terrain, in a world of
+//    Dims dimensions
+template<unsigned Dims>
+void applyContacts(const Terrain& terrain, const ContactModel& model, NodeArrays& n)
+{
+    size_t count = n.size();
+    for(size_t i = 0; i < count; ++i)
+    {
+        double height, normal[MAX_DIMENSIONS];
+        terrain.sample(n.pos[0][i], Dims > 2 ? n.pos[2][i] : 0.0, height, normal);
+        double gap = n.pos[1][i] - height;
+        if( gap >= 0 ) continue;
+        double depth = -gap * normal[1];
+        double normalSpeed = 0.0;
+        for(unsigned d = 0; d < Dims; ++d)
+            normalSpeed += n.vel[d][i] * normal[d];
+        double push = model.stiffness * depth - model.damping * normalSpeed;
+        if( push <= 0 ) continue; //the ground never pulls
+        //viscous friction against the velocity along the ground, capped by Coulomb's law
+        double slip[Dims], slipSquared = 0.0;
+        for(unsigned d = 0; d < Dims; ++d)
+        {
+            slip[d] = n.vel[d][i] - normalSpeed * normal[d];
+            slipSquared += slip[d] * slip[d];
+        }
+        double slipSpeed = std::sqrt(slipSquared);
+        double drag = slipSpeed > 0 ? std::min(model.slipDamping * slipSpeed, model.friction * push) / slipSpeed : 0.0;
+        for(unsigned d = 0; d < Dims; ++d)
+            n.force[d][i] += push * normal[d] - drag * slip[d];
+    }
+}
+
+}; //namespace EVOL_NS
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef _THREAD_POOL_H__
+#define _THREAD_POOL_H__
+
+#include "config.h"
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace EVOL_NS {
+
+//a fixed set of worker threads for splitting a loop across cores; the
+//    calling thread always takes a share of the work itself
+class ThreadPool {
+public:
+//fn(begin, end, thread) handles indices begin up to end, on the given thread
+//    number (0 up to getThreadCount())
+    typedef std::function<void(size_t,size_t,unsigned)> RangeFn;
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+//only one loop runs at a time; other callers wait their turn
+    std::mutex callMutex;
+    const RangeFn* job;
+    size_t jobCount;
+    unsigned generation, remaining;
+    bool stopping;
+//the pool this thread is running a share of a loop for, if any
+    static const ThreadPool*& running()
+    {
+        static thread_local const ThreadPool* pool = nullptr;
+        return pool;
+    }
+    void runShare(const RangeFn& fn, size_t begin, size_t end, unsigned thread)
+    {
+        const ThreadPool* outer = running();
+        running() = this;
+        fn(begin, end, thread);
+        running() = outer;
+    }
+    void chunk(size_t count, unsigned thread, size_t& begin, size_t& end)
+    {
+        unsigned threads = getThreadCount();
+        begin = count * thread / threads;
+        end = count * (thread + 1) / threads;
+    }
+    void work(unsigned thread)
+    {
+        unsigned seen = 0;
+        while( true )
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] {return stopping or generation != seen;});
+            if( stopping ) return;
+            seen = generation;
+            const RangeFn& fn = *job;
+            size_t begin, end;
+            chunk(jobCount, thread, begin, end);
+            lock.unlock();
+            if( begin < end ) runShare(fn, begin, end, thread);
+            lock.lock();
+            if( --remaining == 0 ) done.notify_one();
+        }
+    }
+public:
+//threads counts the calling thread, so a pool of 1 runs everything inline
+    ThreadPool(unsigned threads = std::thread::hardware_concurrency()) :
+        job(nullptr), jobCount(0), generation(0), remaining(0), stopping(false)
+    {
+        for(unsigned t = 1; t < threads; ++t)
+            workers.push_back(std::thread(&ThreadPool::work, this, t));
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator = (const ThreadPool&) = delete;
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for(auto& worker : workers)
+            worker.join();
+    }
+    unsigned getThreadCount() const {return workers.size() + 1;}
+//split [0, count) into one contiguous chunk per thread, run fn on each, and
+//    return once all of them are done.  Called from within a loop already
+//    running on this pool (an evaluation whose world was given the same
+//    pool, say) it runs every chunk itself instead, one after another but
+//    with the same ranges and thread numbers, since the other threads are
+//    busy with the outer loop and waiting for them would never end
+    void parallelFor(size_t count, const RangeFn& fn)
+    {
+        if( running() == this )
+        {
+            for(unsigned thread = 0; thread < getThreadCount(); ++thread)
+            {
+                size_t begin, end;
+                chunk(count, thread, begin, end);
+                if( begin < end ) fn(begin, end, thread);
+            }
+            return;
+        }
+        std::lock_guard<std::mutex> call(callMutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &fn;
+            jobCount = count;
+            remaining = workers.size();
+            ++generation;
+        }
+        wake.notify_all();
+        size_t begin, end;
+        chunk(count, 0, begin, end);
+        if( begin < end ) runShare(fn, begin, end, 0);
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] {return remaining == 0;});
+    }
+};
+
+}; //namespace EVOL_NS
+
+#endif
@@ -3,6 +3,12 @@
 
 #define EVOL_NS evol
 
+//how many dimensions the physics world simulates, 2 or 3; build with
+//    -DEVOL_DIMENSIONS=3 for 3D creatures
+#ifndef EVOL_DIMENSIONS
+#define EVOL_DIMENSIONS 2
+#endif
+
 #include "units.h"
 using namespace units::literals;
 
@@ -98,7 +98,6 @@ public:
 };
 
 class CreatureGenerator {
-    int& time;
     void processNodes(std::string str, Creature& ret)
     {
         std::stringstream ss(str);
@@ -107,7 +106,7 @@ class CreatureGenerator {
             std::string type, name;
             ss >> type >> name;
             if( type == "T" )
-                ret.add(name, new TimeAxon(time));
+                ret.add(name, new TimeAxon());
             else if( type == "C" ) {
                 Axon::OutputTy value;
                 ss >> value;
@@ -123,7 +122,6 @@ class CreatureGenerator {
         }
     }
 public:
-    CreatureGenerator(int& t) : time(t) {}
     Creature create(std::string str)
     {
         std::stringstream ss(str);
@@ -137,6 +135,7 @@ class BallEnd : public PositionableObject {
 public:
     BallEnd(PositTy x, PositTy y) : PositionableObject(x,y) {}
     virtual PositionableObject::MassTy getMass() {return 1.0_kg;}
+    virtual PositionableObjectPtr clone() {return PositionableObjectPtr(new BallEnd(*this));}
 };
 
 int main()
@@ -155,9 +154,9 @@ Connections {\
 }";
     cfb.processText(ss.str());
     std::cout << cfb << std::endl;
-    int simulationTicks = 0;
-    CreatureGenerator generator(simulationTicks);
-    Creature simulation;// = generator.create("T t1\nT t2\n A a1\n S s1\n");
+    SimulationContext ctx;
+    ctx.setTraceSink(TraceSinkPtr(new StreamTraceSink(std::cout)));
+    Creature simulation;// = CreatureGenerator().create("T t1\nT t2\n A a1\n S s1\n");
 
     simulation.addAxonAsInputTo("t1", "a1");
     simulation.addAxonAsInputTo("t2", "a1");
@@ -173,25 +172,16 @@ Connections {\
     simulation.add("m1", new Muscle(Muscle::RigidityTy(1.0)));
     simulation.addAxonAsInputTo("s2", "c1");
 
-    PositionableObjectPtr objectA(new BallEnd(0.0_m,0.0_m));
-    PositionableObjectPtr objectB(new BallEnd(9.0_m,9.0_m));
-    std::dynamic_pointer_cast<Muscle>(simulation.getPartNamed("m1"))->connectEnds(objectA, objectB);
+    simulation.addNode("objectA", new BallEnd(0.0_m,0.0_m));
+    simulation.addNode("objectB", new BallEnd(9.0_m,9.0_m));
+    simulation.connectMuscle("m1", "objectA", "objectB");
+    simulation.addToWorld(ctx.getWorld());
 
-    for(;simulationTicks<10000; ++simulationTicks)
+    for(; ctx.getTicks()<10000; ctx.advanceTick())
     {
-        simulation.update();
-        objectA->update();
-        objectB->update();
-        std::cout << "---------Gen " << simulationTicks << "---------\n";
-        for(auto BI : simulation)
-        {
-            std::cout << BI.first << "(" << BI.second->getTypeAsString() << ")";
-            if( AxonPtr axe = std::dynamic_pointer_cast<Axon>(BI.second) ) std::cout << " : " << axe->getOutputValue();
-            if( MusclePtr musc = std::dynamic_pointer_cast<Muscle>(BI.second) ) std::cout << " : " << musc->getMuscleLength();
-            std::cout << std::endl;
-        }
-        std::cout << "objectA : (" << objectA->getPosX() << ", " << objectA->getPosY() << ")\n";
-        std::cout << "objectB : (" << objectB->getPosX() << ", " << objectB->getPosY() << ")\n";
+        simulation.update(ctx);
+        ctx.getWorld().update();
+        simulation.trace(ctx);
     }
     return 0;
 }